@@ -0,0 +1,475 @@
+/**
+ * Microbenchmarks for the hot paths of Board, MoveList and Evaluator
+ *
+ * Each benchmark is run on every given position for a number of
+ * repetitions; the median time per operation is reported, optionally
+ * together with hardware counters read via perf_event_open (Linux).
+ * Results can be appended to a CSV file to compare builds.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+
+#include "board.h"
+#include "eval.h"
+
+/* positions used if none is given on the command line */
+static const char* defaultPositions[] = {
+    "start", "position-midgame1", "position-midgame2", "position-endgame", 0 };
+
+static int repetitions = 5;
+static int msecsPerRun = 100;
+static bool useCounters = false;
+static const char* csvFile = 0;
+static const char* label = "";
+static const char* only = 0;
+static const char* netFile = 0;
+
+static const char* positions[20];
+static int positionCount = 0;
+
+/* results are accumulated here so the compiler can not drop the work */
+static volatile long long sink;
+
+
+/// Hardware counters
+
+enum { cycles = 0, instructions, branchMisses, l1Misses, counterCount };
+static const char* counterName[counterCount] = {
+    "cycles", "instructions", "branch_misses", "l1d_misses" };
+
+static int counterFD[counterCount] = { -1, -1, -1, -1 };
+
+static bool openCounters()
+{
+    struct perf_event_attr attr;
+    unsigned long long config[counterCount] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_BRANCH_MISSES,
+	PERF_COUNT_HW_CACHE_L1D |
+	(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+	(PERF_COUNT_HW_CACHE_RESULT_MISS << 16) };
+
+    for(int c=0;c<counterCount;c++) {
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = (c == l1Misses) ? PERF_TYPE_HW_CACHE : PERF_TYPE_HARDWARE;
+	attr.config = config[c];
+	attr.disabled = 1;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	counterFD[c] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+	if (counterFD[c] < 0) {
+	    printf("WARNING - Hardware counter '%s' not available; "
+		   "running without counters\n", counterName[c]);
+	    for(int i=0;i<=c;i++) {
+		if (counterFD[i] >= 0) close(counterFD[i]);
+		counterFD[i] = -1;
+	    }
+	    return false;
+	}
+    }
+    return true;
+}
+
+static void startCounters()
+{
+    if (!useCounters) return;
+    for(int c=0;c<counterCount;c++) {
+	ioctl(counterFD[c], PERF_EVENT_IOC_RESET, 0);
+	ioctl(counterFD[c], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+static void stopCounters(long long* values)
+{
+    for(int c=0;c<counterCount;c++) {
+	values[c] = 0;
+	if (!useCounters) continue;
+	ioctl(counterFD[c], PERF_EVENT_IOC_DISABLE, 0);
+	if (read(counterFD[c], &values[c], sizeof(long long)) != sizeof(long long))
+	    values[c] = 0;
+    }
+}
+
+
+/// Benchmarks
+///
+/// Each runs <n> operations on the given board and returns a checksum.
+
+static Evaluator ev;
+static NeuralNet net;
+
+static long long benchGenerateMoves(Board& b, long long n)
+{
+    long long sum = 0;
+    MoveList list;
+    for(long long i=0;i<n;i++) {
+	list.clear();
+	b.generateMoves(list);
+	sum += list.getLength();
+    }
+    return sum;
+}
+
+static long long benchPlayTakeBack(Board& b, long long n)
+{
+    MoveList list;
+    Move moves[MoveList::MaxMoves];
+    int count = 0;
+    long long sum = 0;
+
+    b.generateMoves(list);
+    while(list.getNext(moves[count])) count++;
+    if (count == 0) return 0;
+
+    for(long long i=0;i<n;i++) {
+	b.playMove(moves[i % count]);
+	sum += b.actColor();
+	b.takeBack();
+    }
+    return sum;
+}
+
+static long long benchCountFrom(Board& b, long long n)
+{
+    int* field = b.fieldArray();
+    int stones[Board::RealFields];
+    int count = 0;
+    long long sum = 0;
+
+    for(int f=0;f<Board::AllFields;f++)
+	if (field[f] == Board::color1 || field[f] == Board::color2)
+	    stones[count++] = f;
+    if (count == 0) return 0;
+
+    MoveCounter mc;
+    for(long long i=0;i<n;i++) {
+	int f = stones[i % count];
+	b.countFrom(f, field[f], mc);
+	/* avoid counter overflow */
+	if ((i & 1023) == 1023) {
+	    sum += mc.moveSum();
+	    mc.init();
+	}
+    }
+    return sum + mc.moveSum();
+}
+
+static long long benchCalcEvaluation(Board& b, long long n)
+{
+    long long sum = 0;
+    for(long long i=0;i<n;i++)
+	sum += ev.calcEvaluation(&b);
+    return sum;
+}
+
+static long long benchGetNext(Board& b, long long n)
+{
+    MoveList list;
+    Move m;
+    long long sum = 0;
+
+    b.generateMoves(list);
+    for(long long i=0;i<n;) {
+	list.rewind();
+	while(list.getNext(m) && (i<n)) {
+	    sum += m.field;
+	    i++;
+	}
+    }
+    return sum;
+}
+
+static long long benchSetGetState(Board& b, long long n)
+{
+    char state[1024];
+    Board b2;
+    long long sum = 0;
+
+    strcpy(state, b.getState());
+    for(long long i=0;i<n;i++) {
+	b2.setState(state);
+	sum += strlen(b2.getState());
+    }
+    return sum;
+}
+
+/* children of <b>, as received by the referee (at most <max>) */
+static int childBoards(Board& b, Board* children, int max)
+{
+    MoveList list;
+    Move m;
+    int count = 0;
+
+    b.generateMoves(list);
+    while((count < max) && list.getNext(m)) {
+	children[count] = b;
+	children[count++].playMove(m);
+    }
+    return count;
+}
+
+/* referee before: find move reaching a child by comparing all successors */
+static long long benchMoveToReach(Board& b, long long n)
+{
+    static Board children[MoveList::MaxMoves];
+    int count = childBoards(b, children, MoveList::MaxMoves);
+    long long sum = 0;
+    if (count == 0) return 0;
+
+    for(long long i=0;i<n;i++)
+	sum += b.moveToReach(&children[i % count], false).field;
+    return sum;
+}
+
+/* referee now: successors indexed while waiting, one lookup per move */
+static long long benchSuccessorFind(Board& b, long long n)
+{
+    static Board children[MoveList::MaxMoves];
+    static SuccessorKeys keys;
+    int count = childBoards(b, children, MoveList::MaxMoves);
+    long long sum = 0;
+    if (count == 0) return 0;
+
+    keys.build(b);
+    for(long long i=0;i<n;i++)
+	sum += keys.find(&children[i % count]).field;
+    return sum;
+}
+
+static long long benchSuccessorBuild(Board& b, long long n)
+{
+    static SuccessorKeys keys;
+    long long sum = 0;
+
+    for(long long i=0;i<n;i++) {
+	keys.build(b);
+	sum += keys.size();
+    }
+    return sum;
+}
+
+struct Benchmark {
+    const char* name;
+    const char* op;
+    long long (*run)(Board&, long long);
+};
+
+static Benchmark benchmarks[] = {
+    { "generateMoves",  "generateMoves()",      benchGenerateMoves },
+    { "playTakeBack",   "playMove()+takeBack()", benchPlayTakeBack },
+    { "countFrom",      "countFrom() of a stone", benchCountFrom },
+    { "calcEvaluation", "calcEvaluation()",     benchCalcEvaluation },
+    { "getNext",        "MoveList::getNext()",  benchGetNext },
+    { "setGetState",    "setState()+getState()", benchSetGetState },
+    { "moveToReach",    "moveToReach() of a child", benchMoveToReach },
+    { "successorFind",  "SuccessorKeys::find() of a child", benchSuccessorFind },
+    { "successorBuild", "SuccessorKeys::build()", benchSuccessorBuild },
+    { 0, 0, 0 }
+};
+
+
+static long long nsecsNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return 1000000000LL * ts.tv_sec + ts.tv_nsec;
+}
+
+static int compareDouble(const void* a, const void* b)
+{
+    double d = *(const double*)a - *(const double*)b;
+    return (d<0) ? -1 : (d>0) ? 1 : 0;
+}
+
+/* run one benchmark on one position and report */
+static void runBenchmark(Benchmark& bm, Board& b, const char* pos, FILE* csv)
+{
+    /* calibrate number of operations for one run */
+    long long n = 1000, t;
+    while(1) {
+	t = nsecsNow();
+	sink += bm.run(b, n);
+	t = nsecsNow() - t;
+	if (t > 1000000LL * msecsPerRun / 4) break;
+	n *= 4;
+    }
+    n = (long long) ((double) n * 1000000.0 * msecsPerRun / t);
+    if (n < 1) n = 1;
+
+    double nsPerOp[100];
+    double counterPerOp[100][counterCount];
+    long long values[counterCount];
+    for(int r=0;r<repetitions;r++) {
+	startCounters();
+	t = nsecsNow();
+	sink += bm.run(b, n);
+	t = nsecsNow() - t;
+	stopCounters(values);
+	nsPerOp[r] = (double) t / n;
+	for(int c=0;c<counterCount;c++)
+	    counterPerOp[r][c] = (double) values[c] / n;
+    }
+
+    /* median over repetitions; counters taken from same runs */
+    double sorted[100], counters[counterCount];
+    for(int r=0;r<repetitions;r++) sorted[r] = nsPerOp[r];
+    qsort(sorted, repetitions, sizeof(double), compareDouble);
+    double median = sorted[repetitions/2];
+    for(int c=0;c<counterCount;c++) counters[c] = 0;
+    for(int r=0;r<repetitions;r++)
+	if (nsPerOp[r] == median)
+	    for(int c=0;c<counterCount;c++) counters[c] = counterPerOp[r][c];
+
+    printf("  %-15s %-18s %9.1f ns/op %12.0f ops/s",
+	   bm.name, pos, median, 1e9 / median);
+    if (useCounters)
+	printf("  %7.1f cyc %7.1f ins %5.2f brmiss %5.2f l1miss",
+	       counters[cycles], counters[instructions],
+	       counters[branchMisses], counters[l1Misses]);
+    printf("\n");
+
+    if (csv) {
+	fprintf(csv, "%s,%s,%s,%lld,%.2f,%.0f", label, bm.name, pos,
+		n, median, 1e9 / median);
+	for(int c=0;c<counterCount;c++) {
+	    if (useCounters)
+		fprintf(csv, ",%.2f", counters[c]);
+	    else
+		fprintf(csv, ",");
+	}
+	fprintf(csv, "\n");
+    }
+}
+
+
+static void printHelp(char* prg)
+{
+    printf("Bench V 0.1\n"
+	   "Microbenchmarks for Board, MoveList and Evaluator.\n\n");
+    printf("Usage: %s [options] [<file>|start ...]\n\n"
+	   "  <file>           File containing game position\n"
+	   "  start            Start position\n"
+	   "                   (default: start and shipped positions)\n\n",
+	   prg);
+    printf(" Options:\n"
+	   "  -h / --help      Print this help text\n"
+	   "  -b <name>        Only run benchmark <name>\n"
+	   "  -r <count>       Repetitions per benchmark (default: %d)\n"
+	   "  -t <msecs>       Time per repetition (default: %d)\n"
+	   "  -c               Read hardware counters (perf_event_open)\n"
+	   "  -o <file>        Append results to CSV file\n"
+	   "  -l <label>       Label for results in CSV file (e.g. build)\n"
+	   "  -e <file>        Evaluate with neural network weights from file\n\n",
+	   repetitions, msecsPerRun);
+    printf(" Benchmarks:\n");
+    for(int i=0; benchmarks[i].name; i++)
+	printf("  %-15s  %s\n", benchmarks[i].name, benchmarks[i].op);
+    printf("\n");
+    exit(1);
+}
+
+static void parseArgs(int argc, char* argv[])
+{
+    int arg=0;
+    while(arg+1<argc) {
+	arg++;
+	if (strcmp(argv[arg],"-h")==0 ||
+	    strcmp(argv[arg],"--help")==0) printHelp(argv[0]);
+	if ((strcmp(argv[arg],"-b")==0) && (arg+1<argc)) {
+	    only = argv[++arg];
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-r")==0) && (arg+1<argc)) {
+	    repetitions = atoi(argv[++arg]);
+	    if (repetitions<1) repetitions = 1;
+	    if (repetitions>100) repetitions = 100;
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-t")==0) && (arg+1<argc)) {
+	    msecsPerRun = atoi(argv[++arg]);
+	    if (msecsPerRun<1) msecsPerRun = 1;
+	    continue;
+	}
+	if (strcmp(argv[arg],"-c")==0) {
+	    useCounters = true;
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-o")==0) && (arg+1<argc)) {
+	    csvFile = argv[++arg];
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-l")==0) && (arg+1<argc)) {
+	    label = argv[++arg];
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-e")==0) && (arg+1<argc)) {
+	    netFile = argv[++arg];
+	    continue;
+	}
+	if (argv[arg][0] == '-') {
+	    printf("ERROR - Unknown option %s\n", argv[arg]);
+	    printHelp(argv[0]);
+	}
+	if (positionCount < 19)
+	    positions[positionCount++] = argv[arg];
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    parseArgs(argc, argv);
+
+    const char** pos = positionCount ? positions : defaultPositions;
+    if (positionCount) positions[positionCount] = 0;
+
+    if (useCounters)
+	useCounters = openCounters();
+
+    if (netFile) {
+	if (net.load(netFile))
+	    ev.setNetwork(&net);
+	else
+	    printf("WARNING - Can not use '%s' as network weights\n", netFile);
+    }
+
+    FILE* csv = 0;
+    if (csvFile) {
+	csv = fopen(csvFile, "a");
+	if (!csv)
+	    printf("WARNING - Can not open '%s' for writing results\n", csvFile);
+	else if (ftell(csv) == 0) {
+	    fprintf(csv, "label,benchmark,position,ops,ns_per_op,ops_per_sec");
+	    for(int c=0;c<counterCount;c++)
+		fprintf(csv, ",%s_per_op", counterName[c]);
+	    fprintf(csv, "\n");
+	}
+    }
+
+    for(int i=0; benchmarks[i].name; i++) {
+	if (only && strcmp(only, benchmarks[i].name) != 0) continue;
+
+	printf("%s:\n", benchmarks[i].op);
+	for(int p=0; pos[p]; p++) {
+	    Board b;
+	    if (!b.loadFile(pos[p])) continue;
+	    // playMove/takeBack also update the accumulator
+	    if (ev.network()) {
+		b.setNetwork(ev.network());
+		b.accumulator();
+	    }
+	    runBenchmark(benchmarks[i], b, pos[p], csv);
+	}
+    }
+
+    if (csv) fclose(csv);
+    return 0;
+}
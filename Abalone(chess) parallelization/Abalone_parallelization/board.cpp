@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "search.h"
 #include "board.h"
@@ -85,6 +86,7 @@ Board::Board()
   clear();
   _verbose = 0;
   _ev = 0;
+  _net = 0;
 }
 
 
@@ -98,6 +100,7 @@ void Board::begin(int startColor)
   color = startColor;
   color1Count = color2Count = 14;
   _msecsToPlay[color1] = _msecsToPlay[color2] = 0;
+  _accValid = false;
 
   ::srand(0); // Initialize random sequence
 }
@@ -111,6 +114,7 @@ void Board::clear()
   storedFirst = storedLast = 0;
   color1Count = color2Count = 0;
   _msecsToPlay[color1] = _msecsToPlay[color2] = 0;
+  _accValid = false;
 }
 
 /** countFrom
@@ -118,8 +122,8 @@ void Board::clear()
  * Used for board evaluation to count allowed move types and
  * connectiveness. VERY similar to move generation.
  */
-void Board::countFrom(int startField, int color,
-		     MoveCounter& MCounter)
+template<int C>
+void Board::countFrom(int startField, MoveCounter& MCounter)
 {
   int d, dir, c, actField, c2;
   bool left, right;
@@ -135,7 +139,7 @@ void Board::countFrom(int startField, int color,
       continue;
     }
 
-    if (c != color)
+    if (c != C)
       continue;
 
     /* 2nd == color */
@@ -168,7 +172,7 @@ void Board::countFrom(int startField, int color,
     else if (c == out) {
       continue;
     }
-    else if (c != color) {
+    else if (c != C) {
 
       /* 4th field */
       c = field[actField += dir];
@@ -211,7 +215,7 @@ void Board::countFrom(int startField, int color,
     else if (c == out) {
       continue;
     }
-    else if (c != color) {
+    else if (c != C) {
 
       /* 4nd == opponent */
 
@@ -252,7 +256,7 @@ void Board::countFrom(int startField, int color,
 
     /* 5th field */
     c = field[actField += dir];
-    if (c != color)
+    if (c != C)
       continue;
 
     /* 4nd == color */
@@ -261,15 +265,27 @@ void Board::countFrom(int startField, int color,
   }
 }
 
+template void Board::countFrom<Board::color1>(int, MoveCounter&);
+template void Board::countFrom<Board::color2>(int, MoveCounter&);
+
+void Board::countFrom(int startField, int color, MoveCounter& MCounter)
+{
+  if (color == color1)
+    countFrom<color1>(startField, MCounter);
+  else if (color == color2)
+    countFrom<color2>(startField, MCounter);
+}
+
 
 /* generate moves starting at field <startField> */
+template<int C>
 void Board::generateFieldMoves(int startField, MoveList& list)
 {
   int d, dir, c, actField;
   bool left, right;
-  int opponent = (color == color1) ? color2 : color1;
+  const int opponent = (C == color1) ? color2 : color1;
 
-  assert( field[startField] == color );
+  assert( field[startField] == C );
 
   /* 6 directions	*/
   for(d=1;d<7;d++) {
@@ -282,7 +298,7 @@ void Board::generateFieldMoves(int startField, MoveList& list)
       list.insert(startField, d, Move::move1);
       continue;
     }
-    if (c != color)
+    if (c != C)
       continue;
 
     /* 2nd == color */
@@ -324,7 +340,7 @@ void Board::generateFieldMoves(int startField, MoveList& list)
       }
       continue;
     }
-    if (c != color)
+    if (c != C)
       continue;
 
     /* 3nd == color */
@@ -384,17 +400,26 @@ void Board::generateFieldMoves(int startField, MoveList& list)
 }
 
 
+template<int C>
 void Board::generateMoves(MoveList& list)
 {
 	int actField, f;
 
 	for(f=0;f<RealFields;f++) {
 		actField = order[f];
-		if ( field[actField] == color)
-		   generateFieldMoves(actField, list);
+		if ( field[actField] == C)
+		   generateFieldMoves<C>(actField, list);
 	}
 }
 
+void Board::generateMoves(MoveList& list)
+{
+	if (color == color1)
+	  generateMoves<color1>(list);
+	else if (color == color2)
+	  generateMoves<color2>(list);
+}
+
 
 Move Board::moveToReach(Board* b, bool fuzzy)
 {
@@ -405,26 +430,7 @@ Move Board::moveToReach(Board* b, bool fuzzy)
     if ((state != valid1) && (state != valid2))
 	return m;
     
-    if (!fuzzy) {
-	if (b->moveNo() != _moveNo+1) {
-	    if (_verbose)
-		printf("Board::moveToReach: moveNo %d => %d ?!\n",
-		       _moveNo, b->moveNo());
-	    return m;
-	}
-	/* only time left for player can have decreased */
-	int opponent = (color == color1) ? color2 : color1;
-	if (_msecsToPlay[opponent] != b->msecsToPlay(opponent)) {
-	    if (_verbose)
-		printf("Board::moveToReach: Opponent time changed ?!\n");
-	    return m;
-	}
-	if (_msecsToPlay[color] < b->msecsToPlay(color)) {
-	    if (_verbose)
-		printf("Board::moveToReach: Player time increased ?!\n");
-	    return m;
-	}
-    }
+    if (!fuzzy && !canBeFollowedBy(b)) return m;
 
     /* detect move drawn */
     MoveList l;
@@ -463,6 +469,29 @@ Move Board::moveToReach(Board* b, bool fuzzy)
     return m;
 }
 
+bool Board::canBeFollowedBy(Board* b)
+{
+    if (b->moveNo() != _moveNo+1) {
+	if (_verbose)
+	    printf("Board::moveToReach: moveNo %d => %d ?!\n",
+		   _moveNo, b->moveNo());
+	return false;
+    }
+    /* only time left for player can have decreased */
+    int opponent = (color == color1) ? color2 : color1;
+    if (_msecsToPlay[opponent] != b->msecsToPlay(opponent)) {
+	if (_verbose)
+	    printf("Board::moveToReach: Opponent time changed ?!\n");
+	return false;
+    }
+    if (_msecsToPlay[color] < b->msecsToPlay(color)) {
+	if (_verbose)
+	    printf("Board::moveToReach: Player time increased ?!\n");
+	return false;
+    }
+    return true;
+}
+
 bool Board::hasSameFields(Board* b)
 {
     int f, actField;
@@ -477,10 +506,170 @@ bool Board::hasSameFields(Board* b)
 }
 
 
+/* Random keys for Zobrist hashing: one per field and color,
+ * and one for color2 to move. Fixed seed, so keys are stable
+ * between runs (needed for keys stored in files).
+ */
+static unsigned long long zobristField[Board::AllFields][2];
+static unsigned long long zobristColor2;
+
+static unsigned long long splitmix64(unsigned long long& x)
+{
+    unsigned long long z = (x += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+static struct ZobristInit {
+    ZobristInit() {
+	unsigned long long seed = 19970205;
+	for(int i=0;i<Board::AllFields;i++) {
+	    zobristField[i][0] = splitmix64(seed);
+	    zobristField[i][1] = splitmix64(seed);
+	}
+	zobristColor2 = splitmix64(seed);
+    }
+} zobristInit;
+
+unsigned long long Board::hashKey()
+{
+    unsigned long long key = (color == color2) ? zobristColor2 : 0;
+
+    for(int i=0;i<RealFields;i++) {
+	int f = order[i];
+	if (field[f] == color1) key ^= zobristField[f][0];
+	else if (field[f] == color2) key ^= zobristField[f][1];
+    }
+    return key;
+}
+
+unsigned long long Board::hashKeyAfter(const Move& m, unsigned long long key)
+{
+    key = playMoveKey(m, key);
+    takeBack();
+    return key;
+}
+
+unsigned long long Board::playMoveKey(const Move& m, unsigned long long key)
+{
+    int f[9], before[9];
+    int n = changedFields(m, f);
+    for(int i=0;i<n;i++) before[i] = field[f[i]];
+
+    playMove(m);
+    for(int i=0;i<n;i++) {
+	int now = field[f[i]];
+	if (now == before[i]) continue;
+	if (before[i] == color1) key ^= zobristField[f[i]][0];
+	else if (before[i] == color2) key ^= zobristField[f[i]][1];
+	if (now == color1) key ^= zobristField[f[i]][0];
+	else if (now == color2) key ^= zobristField[f[i]][1];
+    }
+    return key ^ zobristColor2;
+}
+
+
+
+/* Symmetry tables, using axial coordinates (q,r) relative to the
+ * center field 60: field = 60 + q + 11*r. Rotation by 60 degrees maps
+ * (q,r) to (q-r,q), and direction d to d+1. Symmetries 6-11 mirror at
+ * the diagonal (q,r) -> (r,q) first, which swaps left/right moves.
+ */
+static int symField[Board::Symmetries][Board::AllFields];
+static int symDirection[Board::Symmetries][8];
+static int symInverse[Board::Symmetries];
+
+static struct SymmetryInit {
+    SymmetryInit() {
+	for(int s=0;s<Board::Symmetries;s++) {
+	    for(int f=0;f<Board::AllFields;f++) {
+		int q = f%11 - 5, r = f/11 - 5, t;
+		if (s >= 6) t = q, q = r, r = t;
+		for(int i=0;i<s%6;i++)
+		    t = q, q = q-r, r = t;
+		int img = 60 + q + 11*r;
+		// fields outside of the hexagon are never used
+		symField[s][f] = (img >= 0 && img < Board::AllFields) ? img : f;
+	    }
+	    for(int d=1;d<7;d++) {
+		int img = (s >= 6) ? ((9-d) % 6) + 1 : d;
+		symDirection[s][d] = (img-1 + s%6) % 6 + 1;
+	    }
+	    symDirection[s][0] = symDirection[s][6];
+	    symDirection[s][7] = symDirection[s][1];
+	}
+	for(int s=0;s<Board::Symmetries;s++)
+	    for(int i=0;i<Board::Symmetries;i++)
+		if (symField[i][symField[s][61]] == 61 &&
+		    symField[i][symField[s][72]] == 72)
+		    symInverse[s] = i;
+    }
+} symmetryInit;
+
+int Board::symmetricField(int f, int s)
+{
+    return symField[s][f];
+}
+
+int Board::inverseSymmetry(int s)
+{
+    return symInverse[s];
+}
+
+Move Board::symmetricMove(const Move& m, int s)
+{
+    Move res = m;
+    if (m.type == Move::none) return res;
+
+    res.field = symField[s][m.field];
+    res.direction = symDirection[s][m.direction];
+    if (s >= 6) {
+	switch(m.type) {
+	case Move::left2:  res.type = Move::right2; break;
+	case Move::right2: res.type = Move::left2; break;
+	case Move::left3:  res.type = Move::right3; break;
+	case Move::right3: res.type = Move::left3; break;
+	default: break;
+	}
+    }
+    return res;
+}
+
+unsigned long long Board::canonicalKey(int* symmetry)
+{
+    unsigned long long key[Symmetries];
+    for(int s=0;s<Symmetries;s++) key[s] = 0;
+
+    for(int i=0;i<RealFields;i++) {
+	int f = order[i];
+	if (field[f] != color1 && field[f] != color2) continue;
+	int own = (field[f] == color) ? 0 : 1;
+	for(int s=0;s<Symmetries;s++)
+	    key[s] ^= zobristField[symField[s][f]][own];
+    }
+
+    int best = 0;
+    for(int s=1;s<Symmetries;s++)
+	if (key[s] < key[best]) best = s;
+    if (symmetry) *symmetry = best;
+    return key[best];
+}
+
+
+void Board::playMove(const Move& m, int msecs)
+{
+	if (color == color1)
+	  playMove<color1>(m, msecs);
+	else
+	  playMove<color2>(m, msecs);
+}
+
+template<int C>
 void Board::playMove(const Move& m, int msecs)
 {
 	int f, dir, dir2;
-	int opponent = (color == color1) ? color2:color1;
+	const int opponent = (C == color1) ? color2:color1;
 
 	CHECK( isConsistent() );
 
@@ -492,123 +681,130 @@ void Board::playMove(const Move& m, int msecs)
 
 	storedMove[storedLast] = m;
 
+	/* remember fields for update of network accumulator */
+	int changed[9], before[9], nChanged = 0;
+	if (_net && _accValid) {
+	  nChanged = changedFields(m, changed);
+	  for(int i=0;i<nChanged;i++) before[i] = field[changed[i]];
+	}
+
 	f = m.field;
 	CHECK( (m.type >= 0) && (m.type < Move::none));
-	CHECK( field[f] == color );
+	CHECK( field[f] == C );
 	field[f] = free;
 	dir = direction[m.direction];
 
 	switch(m.type) {
 	 case Move::out2:        /* (c c c o o |) */
-		CHECK( field[f + dir] == color );
-		CHECK( field[f + 2*dir] == color );
+		CHECK( field[f + dir] == C );
+		CHECK( field[f + 2*dir] == C );
 		CHECK( field[f + 3*dir] == opponent );
 		CHECK( field[f + 4*dir] == opponent );
 		CHECK( field[f + 5*dir] == out );
-		field[f + 3*dir] = color;
+		field[f + 3*dir] = C;
 		break;
 	 case Move::out1with3:   /* (c c c o |)   */
-		CHECK( field[f + dir] == color );
-		CHECK( field[f + 2*dir] == color );
+		CHECK( field[f + dir] == C );
+		CHECK( field[f + 2*dir] == C );
 		CHECK( field[f + 3*dir] == opponent );
 		CHECK( field[f + 4*dir] == out );
-		field[f + 3*dir] = color;
+		field[f + 3*dir] = C;
 		break;
 	 case Move::move3:       /* (c c c .)     */
-		CHECK( field[f + dir] == color );
-		CHECK( field[f + 2*dir] == color );
+		CHECK( field[f + dir] == C );
+		CHECK( field[f + 2*dir] == C );
 		CHECK( field[f + 3*dir] == free );
-		field[f + 3*dir] = color;
+		field[f + 3*dir] = C;
 		break;
 	 case Move::out1with2:   /* (c c o |)     */
-		CHECK( field[f + dir] == color );
+		CHECK( field[f + dir] == C );
 		CHECK( field[f + 2*dir] == opponent );
 		CHECK( field[f + 3*dir] == out );
-		field[f + 2*dir] = color;
+		field[f + 2*dir] = C;
 		break;
 	 case Move::move2:       /* (c c .)       */
-		CHECK( field[f + dir] == color );
+		CHECK( field[f + dir] == C );
 		CHECK( field[f + 2*dir] == free );
-		field[f + 2*dir] = color;
+		field[f + 2*dir] = C;
 		break;
 	 case Move::push2:       /* (c c c o o .) */
-		CHECK( field[f + dir] == color );
-		CHECK( field[f + 2*dir] == color );
+		CHECK( field[f + dir] == C );
+		CHECK( field[f + 2*dir] == C );
 		CHECK( field[f + 3*dir] == opponent );
 		CHECK( field[f + 4*dir] == opponent );
 		CHECK( field[f + 5*dir] == free );
-		field[f + 3*dir] = color;
+		field[f + 3*dir] = C;
 		field[f + 5*dir] = opponent;
 		break;
 	 case Move::left3:
 		dir2 = direction[m.direction-1];
-		CHECK( field[f + dir] == color );
-		CHECK( field[f + 2*dir] == color );
+		CHECK( field[f + dir] == C );
+		CHECK( field[f + 2*dir] == C );
 		CHECK( field[f + dir2] == free );
 		CHECK( field[f + dir+dir2] == free );
 		CHECK( field[f + 2*dir+dir2] == free );
-		field[f+dir2] = color;
+		field[f+dir2] = C;
 		field[f+=dir] = free;
-		field[f+dir2] = color;
+		field[f+dir2] = C;
 		field[f+=dir] = free;
-		field[f+dir2] = color;
+		field[f+dir2] = C;
 		break;
 	 case Move::right3:
 		dir2 = direction[m.direction+1];
-		CHECK( field[f + dir] == color );
-		CHECK( field[f + 2*dir] == color );
+		CHECK( field[f + dir] == C );
+		CHECK( field[f + 2*dir] == C );
 		CHECK( field[f + dir2] == free );
 		CHECK( field[f + dir+dir2] == free );
 		CHECK( field[f + 2*dir+dir2] == free );
-		field[f+dir2] = color;
+		field[f+dir2] = C;
 		field[f+=dir] = free;
-		field[f+dir2] = color;
+		field[f+dir2] = C;
 		field[f+=dir] = free;
-		field[f+dir2] = color;
+		field[f+dir2] = C;
 		break;
 	 case Move::push1with3:   /* (c c c o .) => (. c c c o) */
-		CHECK( field[f + dir] == color );
-		CHECK( field[f + 2*dir] == color );
+		CHECK( field[f + dir] == C );
+		CHECK( field[f + 2*dir] == C );
 		CHECK( field[f + 3*dir] == opponent );
 		CHECK( field[f + 4*dir] == free );
-		field[f + 3*dir] = color;
+		field[f + 3*dir] = C;
 		field[f + 4*dir] = opponent;
 		break;
 	 case Move::push1with2:   /* (c c o .) => (. c c o) */
-		CHECK( field[f + dir] == color );
+		CHECK( field[f + dir] == C );
 		CHECK( field[f + 2*dir] == opponent );
 		CHECK( field[f + 3*dir] == free );
-		field[f + 2*dir] = color;
+		field[f + 2*dir] = C;
 		field[f + 3*dir] = opponent;
 		break;
 	 case Move::left2:
 		dir2 = direction[m.direction-1];
-		CHECK( field[f + dir] == color );
+		CHECK( field[f + dir] == C );
 		CHECK( field[f + dir2] == free );
 		CHECK( field[f + dir+dir2] == free );
-		field[f+dir2] = color;
+		field[f+dir2] = C;
 		field[f+=dir] = free;
-		field[f+dir2] = color;
+		field[f+dir2] = C;
 		break;
 	 case Move::right2:
 		dir2 = direction[m.direction+1];
-		CHECK( field[f + dir] == color );
+		CHECK( field[f + dir] == C );
 		CHECK( field[f + dir2] == free );
 		CHECK( field[f + dir+dir2] == free );
-		field[f+dir2] = color;
+		field[f+dir2] = C;
 		field[f+=dir] = free;
-		field[f+dir2] = color;
+		field[f+dir2] = C;
 		break;
 	 case Move::move1:       /* (c .) => (. c) */
 		CHECK( field[f + dir] == free );
-		field[f + dir] = color;
+		field[f + dir] = C;
 		break;
 	default:
 	  break;
 	}
 
 	if (m.isOutMove()) {
-		if (color == color1)
+		if (C == color1)
 		  color2Count--;
 		else
 		  color1Count--;
@@ -616,35 +812,53 @@ void Board::playMove(const Move& m, int msecs)
 
 	/* adjust move number and time */
 	_moveNo++;
-	if ((_msecsToPlay[color]>0) && (msecs>0)) {
-	    if (_msecsToPlay[color] > msecs)
-		_msecsToPlay[color] -= msecs;
+	if ((_msecsToPlay[C]>0) && (msecs>0)) {
+	    if (_msecsToPlay[C] > msecs)
+		_msecsToPlay[C] -= msecs;
 	    else
-		_msecsToPlay[color] = 0;
+		_msecsToPlay[C] = 0;
 	}
 
 	/* change actual color */
 	color = opponent;
 
+	if (nChanged) updateAccumulator(changed, before, nChanged);
+
 	CHECK( isConsistent() );
 
 }
 
+bool Board::takeBack()
+{
+  /* color of player who played the move to take back */
+  if (color == color1)
+    return takeBack<color2>();
+  else
+    return takeBack<color1>();
+}
+
+template<int C>
 bool Board::takeBack()
 {
   int f, dir, dir2;
-  int opponent = color;
+  const int opponent = (C == color1) ? color2:color1;
   Move& m = storedMove[storedLast];
 
   CHECK( isConsistent() );
 
   if (storedFirst == storedLast) return false;
 
+  int changed[9], before[9], nChanged = 0;
+  if (_net && _accValid) {
+    nChanged = changedFields(m, changed);
+    for(int i=0;i<nChanged;i++) before[i] = field[changed[i]];
+  }
+
   /* change actual color */
-  color = (color == color1) ? color2:color1;
+  color = C;
 
   if (m.isOutMove()) {
-    if (color == color1)
+    if (C == color1)
       color2Count++;
     else
       color1Count++;
@@ -652,46 +866,46 @@ bool Board::takeBack()
 
   f = m.field;
   CHECK( field[f] == free );
-  field[f] = color;
+  field[f] = C;
   dir = direction[m.direction];
 
   switch(m.type) {
   case Move::out2:        /* (. c c c o |) => (c c c o o |) */
-    CHECK( field[f + dir] == color );
-    CHECK( field[f + 2*dir] == color );
-    CHECK( field[f + 3*dir] == color );
+    CHECK( field[f + dir] == C );
+    CHECK( field[f + 2*dir] == C );
+    CHECK( field[f + 3*dir] == C );
     CHECK( field[f + 4*dir] == opponent );
     CHECK( field[f + 5*dir] == out );
     field[f + 3*dir] = opponent;
     break;
   case Move::out1with3:   /* (. c c c |) => (c c c o |) */
-    CHECK( field[f + dir] == color );
-    CHECK( field[f + 2*dir] == color );
-    CHECK( field[f + 3*dir] == color );
+    CHECK( field[f + dir] == C );
+    CHECK( field[f + 2*dir] == C );
+    CHECK( field[f + 3*dir] == C );
     CHECK( field[f + 4*dir] == out );
     field[f + 3*dir] = opponent;
     break;
   case Move::move3:       /* (. c c c) => (c c c .)     */
-    CHECK( field[f + dir] == color );
-    CHECK( field[f + 2*dir] == color );
-    CHECK( field[f + 3*dir] == color );
+    CHECK( field[f + dir] == C );
+    CHECK( field[f + 2*dir] == C );
+    CHECK( field[f + 3*dir] == C );
     field[f + 3*dir] = free;
     break;
   case Move::out1with2:   /* (. c c | ) => (c c o |)     */
-    CHECK( field[f + dir] == color );
-    CHECK( field[f + 2*dir] == color );
+    CHECK( field[f + dir] == C );
+    CHECK( field[f + 2*dir] == C );
     CHECK( field[f + 3*dir] == out );
     field[f + 2*dir] = opponent;
     break;
   case Move::move2:       /* (. c c) => (c c .)       */
-    CHECK( field[f + dir] == color );
-    CHECK( field[f + 2*dir] == color );
+    CHECK( field[f + dir] == C );
+    CHECK( field[f + 2*dir] == C );
     field[f + 2*dir] = free;
     break;
   case Move::push2:       /* (. c c c o o) => (c c c o o .) */
-    CHECK( field[f + dir] == color );
-    CHECK( field[f + 2*dir] == color );
-    CHECK( field[f + 3*dir] == color );
+    CHECK( field[f + dir] == C );
+    CHECK( field[f + 2*dir] == C );
+    CHECK( field[f + 3*dir] == C );
     CHECK( field[f + 4*dir] == opponent );
     CHECK( field[f + 5*dir] == opponent );
     field[f + 3*dir] = opponent;
@@ -701,39 +915,39 @@ bool Board::takeBack()
     dir2 = direction[m.direction-1];
     CHECK( field[f + dir] == free );
     CHECK( field[f + 2*dir] == free );
-    CHECK( field[f + dir2] == color );
-    CHECK( field[f + dir+dir2] == color );
-    CHECK( field[f + 2*dir+dir2] == color );
+    CHECK( field[f + dir2] == C );
+    CHECK( field[f + dir+dir2] == C );
+    CHECK( field[f + 2*dir+dir2] == C );
     field[f+dir2] = free;
-    field[f+=dir] = color;
+    field[f+=dir] = C;
     field[f+dir2] = free;
-    field[f+=dir] = color;
+    field[f+=dir] = C;
     field[f+dir2] = free;
     break;
   case Move::right3:
     dir2 = direction[m.direction+1];
     CHECK( field[f + dir] == free );
     CHECK( field[f + 2*dir] == free );
-    CHECK( field[f + dir2] == color );
-    CHECK( field[f + dir+dir2] == color );
-    CHECK( field[f + 2*dir+dir2] == color );
+    CHECK( field[f + dir2] == C );
+    CHECK( field[f + dir+dir2] == C );
+    CHECK( field[f + 2*dir+dir2] == C );
     field[f+dir2] = free;
-    field[f+=dir] = color;
+    field[f+=dir] = C;
     field[f+dir2] = free;
-    field[f+=dir] = color;
+    field[f+=dir] = C;
     field[f+dir2] = free;
     break;
   case Move::push1with3:   /* (. c c c o) => (c c c o .) */
-    CHECK( field[f + dir] == color );
-    CHECK( field[f + 2*dir] == color );
-    CHECK( field[f + 3*dir] == color );
+    CHECK( field[f + dir] == C );
+    CHECK( field[f + 2*dir] == C );
+    CHECK( field[f + 3*dir] == C );
     CHECK( field[f + 4*dir] == opponent );
     field[f + 3*dir] = opponent;
     field[f + 4*dir] = free;
     break;
   case Move::push1with2:   /* (. c c o) => (c c o .) */
-    CHECK( field[f + dir] == color );
-    CHECK( field[f + 2*dir] == color );
+    CHECK( field[f + dir] == C );
+    CHECK( field[f + 2*dir] == C );
     CHECK( field[f + 3*dir] == opponent );
     field[f + 2*dir] = opponent;
     field[f + 3*dir] = free;
@@ -741,23 +955,23 @@ bool Board::takeBack()
   case Move::left2:
     dir2 = direction[m.direction-1];
     CHECK( field[f + dir] == free );
-    CHECK( field[f + dir2] == color );
-    CHECK( field[f + dir+dir2] == color );
+    CHECK( field[f + dir2] == C );
+    CHECK( field[f + dir+dir2] == C );
     field[f+dir2] = free;
-    field[f+=dir] = color;
+    field[f+=dir] = C;
     field[f+dir2] = free;
     break;
   case Move::right2:
     dir2 = direction[m.direction+1];
     CHECK( field[f + dir] == free );
-    CHECK( field[f + dir2] == color );
-    CHECK( field[f + dir+dir2] == color );
+    CHECK( field[f + dir2] == C );
+    CHECK( field[f + dir+dir2] == C );
     field[f+dir2] = free;
-    field[f+=dir] = color;
+    field[f+=dir] = C;
     field[f+dir2] = free;
     break;
   case Move::move1:       /* (. c) => (c .) */
-    CHECK( field[f + dir] == color );
+    CHECK( field[f + dir] == C );
     field[f + dir] = free;
     break;
   default:
@@ -769,11 +983,56 @@ bool Board::takeBack()
   /* adjust move number. Time is intentionally not reset */
   _moveNo--;
 
+  if (nChanged) updateAccumulator(changed, before, nChanged);
+
   CHECK( isConsistent() );
 
   return true;
 }
 
+int Board::changedFields(const Move& m, int* f)
+{
+  int n = 0, dir = direction[m.direction];
+  int side = (m.type == Move::left3 || m.type == Move::left2) ? -1 :
+             (m.type == Move::right3 || m.type == Move::right2) ? 1 : 0;
+
+  /* in-line moves change up to 6 fields in their direction,
+   * side-way moves 3 fields and their neighbours */
+  for(int i=0;i<6;i++) {
+    int ff = m.field + i*dir;
+    if (ff < 0 || ff >= AllFields) break;
+    f[n++] = ff;
+  }
+  if (side) {
+    int dir2 = direction[m.direction + side];
+    n = 3;
+    for(int i=0;i<3;i++)
+      f[n++] = m.field + i*dir + dir2;
+  }
+  return n;
+}
+
+void Board::updateAccumulator(const int* f, const int* before, int n)
+{
+  for(int i=0;i<n;i++) {
+    int now = field[f[i]];
+    if (now == before[i]) continue;
+    if (before[i] == color1 || before[i] == color2)
+      _net->removeToken(_acc, f[i], before[i]);
+    if (now == color1 || now == color2)
+      _net->addToken(_acc, f[i], now);
+  }
+}
+
+const NNAccumulator& Board::accumulator()
+{
+  if (!_accValid && _net) {
+    _net->refresh(_acc, field);
+    _accValid = true;
+  }
+  return _acc;
+}
+
 int Board::movesStored()
 {
   int c = storedLast - storedFirst;
@@ -1001,6 +1260,7 @@ bool Board::setState(char* s)
   color2Count = 0;
   _msecsToPlay[color1] = 0;
   _msecsToPlay[color2] = 0;
+  _accValid = false;
  
   if (s == 0) return false;
 
@@ -1081,9 +1341,99 @@ bool Board::setState(char* s)
   return true;
 }
 
+bool Board::readState(FILE* file)
+{
+  char tmp[500];
+  int len = 0, c;
+  while( len<499 && (c=fgetc(file)) != EOF)
+      tmp[len++] = (char) c;
+  tmp[len++]=0;
+
+  return setState(tmp);
+}
+
+bool Board::loadFile(const char* name)
+{
+  if (strcmp(name, "start") == 0) {
+      begin(color1);
+      return true;
+  }
+
+  FILE* file = fopen(name, "r");
+  if (!file) {
+      printf("ERROR - Can not open '%s' for reading position\n", name);
+      return false;
+  }
+  bool ok = readState(file);
+  fclose(file);
+
+  if (!ok) {
+      printf("ERROR - Can not parse position in '%s'\n", name);
+      return false;
+  }
+  return true;
+}
+
 
 void Board::setSpyLevel(int level)
 {
   spyLevel = level;
 }
 
+
+
+/// SuccessorKeys
+
+void SuccessorKeys::clear()
+{
+    for(int i=0; i<slots; i++)
+	_key[i] = 0;
+    _board = 0;
+    _count = 0;
+}
+
+void SuccessorKeys::build(Board& b)
+{
+    clear();
+    _board = &b;
+
+    /* can not move from invalid position */
+    int state = b.validState();
+    if ((state != Board::valid1) && (state != Board::valid2))
+	return;
+
+    MoveList list;
+    Move m;
+    unsigned long long parentKey = b.hashKey();
+    b.generateMoves(list);
+    while(list.getNext(m, Move::maxMoveType)) {
+	unsigned long long key = b.hashKeyAfter(m, parentKey);
+	if (key == 0) continue;
+
+	/* different moves can reach the same position: keep the first */
+	int i = key & (slots-1);
+	while((_key[i] != 0) && (_key[i] != key)) i = (i+1) & (slots-1);
+	if (_key[i] == key) continue;
+	_key[i] = key;
+	_move[i] = m;
+	_count++;
+    }
+}
+
+Move SuccessorKeys::find(Board* b)
+{
+    Move m;
+    if (_count == 0) return m;
+
+    unsigned long long key = b->hashKey();
+    for(int i = key & (slots-1); _key[i] != 0; i = (i+1) & (slots-1)) {
+	if (_key[i] != key) continue;
+
+	_board->playMove(_move[i]);
+	bool isSame = _board->hasSameFields(b);
+	_board->takeBack();
+	if (isSame) m = _move[i];
+	break;
+    }
+    return m;
+}
@@ -1,6 +1,7 @@
 /*
  * Classes
  * - Board: represents a game state
+ * - SuccessorKeys: moves of a position, keyed by positions they lead to
  * - EvalScheme: evaluation scheme
  *
  * (c) 1997-2005, Josef Weidendorfer
@@ -9,7 +10,10 @@
 #ifndef BOARD_H
 #define BOARD_H
 
+#include <stdio.h>
+
 #include "move.h"
+#include "nnue.h"
 
 class SearchStrategy;
 class Evaluator;
@@ -55,6 +59,7 @@ class MoveCounter
 class Board
 {
     friend class Evaluator;
+    friend class EvalBatch;
 
  public:
   Board();
@@ -89,6 +94,8 @@ class Board
 
   /* helper in evaluation: calculate move type counts */
   void countFrom(int startField, int color, MoveCounter&);
+  /* same for tokens of color <C> known at compile time */
+  template<int C> void countFrom(int startField, MoveCounter&);
 
   /* Generate list of allowed moves for player with <color>
    * Returns a calculated value for actual position */
@@ -100,9 +107,39 @@ class Board
    */
   Move moveToReach(Board*, bool fuzzy);
 
+  /* Can position <b> follow this one regarding move number and times?
+   * (only the time left for the side to move can have decreased) */
+  bool canBeFollowedBy(Board* b);
+
   /** Check if another board has same tokens set */
   bool hasSameFields(Board*);
 
+  /* Zobrist hash key of tokens and color to move (not times/move number) */
+  unsigned long long hashKey();
+  /* hash key after playing <m>, from <key> of this position: only the
+   * fields changed by the move are hashed again */
+  unsigned long long hashKeyAfter(const Move& m, unsigned long long key);
+  /* play <m> and return the hash key of the new position, from <key>
+   * of the position before, as hashKeyAfter */
+  unsigned long long playMoveKey(const Move& m, unsigned long long key);
+
+  /* Symmetries of the board: 6 rotations, each optionally mirrored.
+   * Symmetry 0 is the identity. */
+  enum { Symmetries = 12 };
+
+  /* Hash key which is the same for all symmetric images of the position,
+   * and for the position with colors swapped (tokens are keyed relative
+   * to the color to move). Sets <symmetry> to the symmetry mapping this
+   * position to the image with the minimal key.
+   */
+  unsigned long long canonicalKey(int* symmetry = 0);
+
+  /* map field/move by symmetry <s> */
+  static int symmetricField(int f, int s);
+  static Move symmetricMove(const Move& m, int s);
+  /* symmetry undoing <s> */
+  static int inverseSymmetry(int s);
+
 
   /* Play the given move.
    * Played moves can be taken back (<MvsStored> moves are remembered)
@@ -123,10 +160,16 @@ class Board
   /* Evaluator to use */
   void setEvaluator(Evaluator* ev) { _ev = ev; }
 
+  /* Network whose accumulator is kept up to date by playMove/takeBack
+   * (0: none). Calculated from all tokens on first use. */
+  void setNetwork(const NeuralNet* net) { _net = net; _accValid = false; }
+  const NeuralNet* network() const { return _net; }
+  const NNAccumulator& accumulator();
+
   void setActColor(int c) { color=c; }
   void setColor1Count(int c) { color1Count = c; }
   void setColor2Count(int c) { color2Count = c; }
-  void setField(int i, int v) { field[i] = v; }
+  void setField(int i, int v) { field[i] = v; _accValid = false; }
 
   void setSpyLevel(int);
 
@@ -164,6 +207,11 @@ class Board
   char* getShortState();
   /* Returns true if new state was set */
   bool setState(char*);
+  /* Set state read from <file> (up to 500 characters) */
+  bool readState(FILE* file);
+  /* Set state from file <name>, or start position for "start".
+   * Prints an error and returns false if reading fails */
+  bool loadFile(const char* name);
 
   void setVerbose(int v) { _verbose = v; }
 
@@ -177,8 +225,20 @@ class Board
  private:
   void setFieldValues();
 
+  /* Versions of public methods specialized for the color <C> to
+   * move (playMove, generateMoves) or having moved (takeBack), so
+   * that colors are constants. The public methods dispatch once. */
+  template<int C> void playMove(const Move& m, int msecs);
+  template<int C> bool takeBack();
+  template<int C> void generateMoves(MoveList& list);
+
   /* helper function for generateMoves */
-  void generateFieldMoves(int, MoveList&);
+  template<int C> void generateFieldMoves(int, MoveList&);
+
+  /* fields which can be changed by move <m>; returns their number */
+  int changedFields(const Move& m, int* f);
+  /* update accumulator for the <n> fields <f> which had values <before> */
+  void updateAccumulator(const int* f, const int* before, int n);
 
   // random seed
   int seed;
@@ -198,6 +258,10 @@ class Board
   Evaluator* _ev;
   int _verbose;
 
+  const NeuralNet* _net;
+  bool _accValid;
+  NNAccumulator _acc;
+
   /* constant arrays */
   static int startBoard[AllFields];
   static int order[RealFields];
@@ -214,4 +278,36 @@ inline int Board::operator[](int no) const
   return (no<12 || no>120) ? out : field[no];
 }
 
+
+/**
+ * SuccessorKeys: the moves allowed in a position, keyed by the hash
+ * key of the position each one leads to. Finds the move reaching a
+ * given position with one lookup, instead of playing all moves and
+ * comparing fields as Board::moveToReach does.
+ */
+class SuccessorKeys
+{
+ public:
+  SuccessorKeys() { clear(); }
+
+  void clear();
+  /* index the moves allowed in <b> (none if the game has ended) */
+  void build(Board& b);
+  int size() { return _count; }
+
+  /* move leading from the indexed position to <b>; type Move::none if
+   * <b> is no successor. Fields are compared, so key collisions can
+   * not give a wrong move. */
+  Move find(Board* b);
+
+ private:
+  /* open addressing; more than twice the moves of any position */
+  enum { slots = 512 };
+
+  Board* _board;                  // indexed position
+  unsigned long long _key[slots]; // 0: empty slot
+  Move _move[slots];
+  int _count;
+};
+
 #endif
@@ -0,0 +1,132 @@
+/**
+ * OpeningBook: precomputed best moves for opening positions
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "book.h"
+#include "board.h"
+
+static const char bookMagic[8] = { 'A','B','B','O','O','K','0','1' };
+
+
+OpeningBook::OpeningBook()
+{
+    _map = 0;
+    _mapSize = 0;
+    _entries = 0;
+    _count = 0;
+    _flags = 0;
+}
+
+bool OpeningBook::open(const char* file)
+{
+    close();
+
+    int fd = ::open(file, O_RDONLY);
+    if (fd<0) return false;
+
+    struct stat st;
+    if ((fstat(fd, &st) < 0) || (st.st_size < (long) sizeof(Header))) {
+	::close(fd);
+	return false;
+    }
+
+    void* map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) return false;
+
+    Header* h = (Header*) map;
+    if ((memcmp(h->magic, bookMagic, sizeof(bookMagic)) != 0) ||
+	((long) (sizeof(Header) + h->count * sizeof(Entry)) > st.st_size)) {
+	munmap(map, st.st_size);
+	return false;
+    }
+
+    _map = map;
+    _mapSize = st.st_size;
+    _entries = (const Entry*) (h+1);
+    _count = h->count;
+    _flags = h->flags;
+    return true;
+}
+
+void OpeningBook::close()
+{
+    if (_map) munmap(_map, _mapSize);
+    _map = 0;
+    _mapSize = 0;
+    _entries = 0;
+    _count = 0;
+    _flags = 0;
+}
+
+bool OpeningBook::probe(Board* b, Move& m, int* value)
+{
+    if (_count == 0) return false;
+
+    int symmetry = 0;
+    unsigned long long key = isSymmetric() ? b->canonicalKey(&symmetry) : b->hashKey();
+
+    /* binary search for key */
+    int lo = 0, hi = _count-1;
+    while(lo < hi) {
+	int mid = (lo + hi) / 2;
+	if (_entries[mid].key < key)
+	    lo = mid+1;
+	else
+	    hi = mid;
+    }
+    const Entry& e = _entries[lo];
+    if (e.key != key) return false;
+
+    /* move for our image of the position */
+    Move bm(e.field, e.direction, (Move::MoveType) e.type);
+    if (symmetry) bm = Board::symmetricMove(bm, Board::inverseSymmetry(symmetry));
+
+    /* protect against key collisions and broken files */
+    MoveList list;
+    Move mm;
+    b->generateMoves(list);
+    while(list.getNext(mm)) {
+	if ((mm.field == bm.field) && (mm.direction == bm.direction) &&
+	    (mm.type == bm.type)) {
+	    m = mm;
+	    if (value) *value = e.value;
+	    return true;
+	}
+    }
+    return false;
+}
+
+static int compareEntries(const void* a, const void* b)
+{
+    unsigned long long k1 = ((const OpeningBook::Entry*)a)->key;
+    unsigned long long k2 = ((const OpeningBook::Entry*)b)->key;
+    return (k1<k2) ? -1 : (k1>k2) ? 1 : 0;
+}
+
+bool OpeningBook::write(const char* file, Entry* entries, int count,
+			unsigned int flags)
+{
+    qsort(entries, count, sizeof(Entry), compareEntries);
+
+    FILE* f = fopen(file, "wb");
+    if (!f) return false;
+
+    Header h;
+    memcpy(h.magic, bookMagic, sizeof(bookMagic));
+    h.count = count;
+    h.flags = flags;
+
+    bool ok = (fwrite(&h, sizeof(h), 1, f) == 1) &&
+	(fwrite(entries, sizeof(Entry), count, f) == (size_t) count);
+    if (fclose(f) != 0) ok = false;
+    return ok;
+}
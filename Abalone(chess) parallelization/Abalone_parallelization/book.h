@@ -0,0 +1,68 @@
+/**
+ * OpeningBook: precomputed best moves for opening positions
+ *
+ * A book file is a header followed by entries sorted by the
+ * Zobrist key of the position (see Board::hashKey). The file is
+ * mapped read-only into memory, and probed by binary search.
+ * Book files are written by "makebook". In a symmetric book, keys are
+ * canonical keys (see Board::canonicalKey) and moves are stored for the
+ * canonical image of the position.
+ */
+
+#ifndef BOOK_H
+#define BOOK_H
+
+#include "move.h"
+
+class Board;
+
+class OpeningBook
+{
+ public:
+    /* One book position with the move to play in it: 16 bytes */
+    struct Entry {
+	unsigned long long key;
+	short field;
+	unsigned char direction;
+	unsigned char type;
+	short value;      /* search value, from view of side to move */
+	unsigned char depth;
+	unsigned char flags;
+    };
+
+    /* header flags */
+    enum { symmetric = 1 };
+
+    OpeningBook();
+    ~OpeningBook() { close(); }
+
+    /* map book file into memory; returns false if not a valid book */
+    bool open(const char* file);
+    void close();
+
+    int size() { return _count; }
+    bool isSymmetric() { return _flags & symmetric; }
+
+    /* Look up position. If found, set move (checked to be allowed
+     * in the position) and return true */
+    bool probe(Board*, Move&, int* value = 0);
+
+    /* write sorted entries to a book file */
+    static bool write(const char* file, Entry* entries, int count,
+		      unsigned int flags = 0);
+
+ private:
+    struct Header {
+	char magic[8];
+	unsigned int count;
+	unsigned int flags;
+    };
+
+    void* _map;
+    long _mapSize;
+    const Entry* _entries;
+    int _count;
+    unsigned int _flags;
+};
+
+#endif
@@ -2,16 +2,26 @@
  * EvalScheme and Evaluator
  */
 
-#include "iostream"
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+
 #include "eval.h"
 
 
 // Default Values
-static int defaultRingValue[] = { 60, 55, 40, 10, 0 };
-static int defaultStoneValue[]= { 0,-800,-1800,-3000,-4400,-6000 };
-static int defaultMoveValue[Move::typeCount] = { 40, 30, 30, 15, 14, 13, 5, 5, 5, 2, 2, 2, 1 };
+static constexpr int defaultRingValue[] = { 60, 55, 40, 10, 0 };
+static constexpr int defaultStoneValue[]= { 0,-800,-1800,-3000,-4400,-6000 };
+static constexpr int defaultMoveValue[Move::typeCount] = { 40, 30, 30, 15, 14, 13, 5, 5, 5, 2, 2, 2, 1 };
+
+static constexpr int defaultInARowValue[MoveCounter::inARowCount]= { 2, 5, 4, 3 };
+
+/* Rings of fields in Board::order: first index and length of each */
+static constexpr int ringStart[5] = { 0, 1, 7, 19, 37 };
+static constexpr int ringLength[5] = { 1, 6, 12, 18, 24 };
 
-static int defaultInARowValue[MoveCounter::inARowCount]= { 2, 5, 4, 3 };
+/* geometry tables for batch evaluation, see below */
+static bool initBatchLines();
 
 
 /**
@@ -40,17 +50,82 @@ void EvalScheme::setDefaults()
 }
   
 
-void EvalScheme::read(char* file)
+/* groups of coefficients in a scheme file, in order of param() */
+static const char* groupName[4] = {
+  "ringValue", "stoneValue", "moveValue", "inARowValue" };
+static const int groupFirst[4] = {
+  0, 5, 10, 10 + Move::typeCount };
+static const int groupSize[4] = {
+  5, 5, Move::typeCount, MoveCounter::inARowCount };
+
+bool EvalScheme::read(const char* file)
 {
-    if (file == 0 || *file == 0) return;
+    if (file == 0 || *file == 0) return false;
+
+    FILE* f = fopen(file, "r");
+    if (!f) return false;
+
+    char line[256];
+    int groups = 0;
+    while(fgets(line, sizeof(line), f)) {
+      char* c = strchr(line, '#');
+      if (c) *c = 0;
+      c = strchr(line, '=');
+      if (!c) continue;
+
+      for(int g=0;g<4;g++) {
+	if (strncmp(line, groupName[g], strlen(groupName[g])) != 0) continue;
+	groups++;
+	char* s = c+1;
+	for(int i=0;i<groupSize[g];i++) {
+	  char* end;
+	  long v = strtol(s, &end, 10);
+	  if (end == s) break;
+	  setParam(groupFirst[g] + i, (int) v);
+	  s = end;
+	}
+      }
+    }
+    fclose(f);
+    return groups > 0;
+}
+
 
-    // TODO
+bool EvalScheme::save(const char* file)
+{
+    FILE* f = fopen(file, "w");
+    if (!f) return false;
+
+    fprintf(f, "# Abalone evaluation scheme\n"
+	    "# ringValue: per token from center to border ring\n"
+	    "# stoneValue: for 1..5 tokens lost\n"
+	    "# moveValue: per possible move of a type (see Move::MoveType)\n"
+	    "# inARowValue: per 2..5 tokens in a row\n");
+    for(int g=0;g<4;g++) {
+      fprintf(f, "%s =", groupName[g]);
+      for(int i=0;i<groupSize[g];i++)
+	fprintf(f, " %d", param(groupFirst[g] + i));
+      fprintf(f, "\n");
+    }
+    return (fclose(f) == 0);
 }
 
+int EvalScheme::param(int i) const
+{
+  if (i<0 || i>=paramCount) return 0;
+  if (i<5) return _ringValue[i];
+  if (i<10) return _stoneValue[i-4];
+  if (i<10+Move::typeCount) return _moveValue[i-10];
+  return _inARowValue[i-10-Move::typeCount];
+}
 
-void EvalScheme::save(char* file)
+void EvalScheme::setParam(int i, int value)
 {
-    // TODO
+  if (i<0 || i>=paramCount) return;
+  if (i<5) setRingValue(i, value);
+  else if (i<10) setStoneValue(i-4, value);
+  else if (i<10+Move::typeCount) setMoveValue(i-10, value);
+  else setInARowValue(i-10-Move::typeCount, value);
 }
 
 void EvalScheme::setRingValue(int ring, int value)
@@ -81,48 +156,61 @@ void EvalScheme::setInARowValue(int stones, int value)
 
 /// Evaluator
 
-int Evaluator::fieldValue[61];
+/* Scheme used if no other is given. Not modified after construction */
+static EvalScheme* defaultScheme()
+{
+  static EvalScheme scheme(0);
+  return &scheme;
+}
 
-Evaluator::Evaluator()
+Evaluator::Evaluator(EvalScheme* scheme)
 {
-    _evalScheme = 0;
+    static bool linesReady = initBatchLines();
+    (void) linesReady;
+
+    _rotation = 0;
+    _net = 0;
+    setEvalScheme(scheme);
 }
 
 void Evaluator::setEvalScheme(EvalScheme* scheme)
 {
   if (!scheme)
-    scheme = new EvalScheme(0);
+    scheme = defaultScheme();
 
   _evalScheme = scheme;
   setFieldValues();
 }
 
+/* (Re-)build evaluation tables from scheme and rotation */
 void Evaluator::setFieldValues()
 {
   if (!_evalScheme) return;
 
-  int i, j = 0, k = 59;
-  int ringValue[5];
+  EvalTables& t = _tables;
 
-  for(i=0;i<5;i++) {
-    ringValue[i] = _evalScheme->ringValue(i);
+  for(int r=0;r<5;r++) {
+    int value = _evalScheme->ringValue(r);
+    for(int i=0;i<ringLength[r];i++)
+      t.fieldValue[ringStart[r] + i] = value;
   }
 
-  fieldValue[0] = ringValue[0];
-  for(i=1;i<7;i++)
-    fieldValue[i] = ringValue[1];
-  for(i=7;i<19;i++)
-    fieldValue[i] = ringValue[2];
-  for(i=19;i<37;i++)
-    fieldValue[i] = ringValue[3];
-  for(i=37;i<61;i++)
-    fieldValue[i] = ringValue[4];
-}
+  /* rotate rings around the center as requested by changeEvaluation() */
+  if (_rotation > 0) {
+    int tmp[RealFields];
+    for(int i=0;i<RealFields;i++) tmp[i] = t.fieldValue[i];
+    for(int r=1;r<5;r++)
+      for(int i=0;i<ringLength[r];i++)
+	t.fieldValue[ringStart[r] + i] =
+	  tmp[ringStart[r] + (i + _rotation) % ringLength[r]];
+  }
 
-void Evaluator::setBoard(Board* b)
-{
-    _board = b;
-    field = b->fieldArray();
+  for(int i=0;i<Move::typeCount;i++)
+    t.moveValue[i] = _evalScheme->moveValue(i);
+  for(int i=0;i<MoveCounter::inARowCount;i++)
+    t.inARowValue[i] = _evalScheme->inARowValue(i);
+  for(int i=0;i<6;i++)
+    t.stoneValue[i] = _evalScheme->stoneValue(i);
 }
 
 
@@ -133,16 +221,20 @@ void Evaluator::setBoard(Board* b)
  * NB: This means a higher value for better position of
  *     'color before last move'
  */
-int Evaluator::calcEvaluation(Board* b)
+int Evaluator::calcEvaluation(Board* b) const
 {
-    setBoard(b);
-    int color = b->actColor();
+  if (b->actColor() == color2)
+    return calcEvaluation<color2>(b);
+  return calcEvaluation<color1>(b);
+}
+
+template<int C>
+int Evaluator::calcEvaluation(Board* b) const
+{
+  const int opponent = (C == color1) ? color2 : color1;
+  int* field = b->fieldArray();
+  const EvalTables& t = _tables;
 
-    if (!_evalScheme) {
-	// Use default values if not set
-	setEvalScheme();
-    }
-    
   MoveCounter cColor, cOpponent;
 
   int f,i,j;
@@ -153,25 +245,30 @@ int Evaluator::calcEvaluation(Board* b)
   int valueSum;
 
   /* First check simple winner condition */
-  int color1Count = _board->getColor1Count();
-  int color2Count = _board->getColor2Count();
+  int color1Count = b->getColor1Count();
+  int color2Count = b->getColor2Count();
   if (color1Count <9)
-    valueSum = (color==color1) ? 16000 : -16000;
+    valueSum = (C==color1) ? 16000 : -16000;
   else if (color2Count <9)
-    valueSum = (color==color2) ? 16000 : -16000;
+    valueSum = (C==color2) ? 16000 : -16000;
+  else if (_net) {
+    /* network gives value for side to move */
+    if (b->network() != _net) b->setNetwork(_net);
+    valueSum = -_net->evaluate(b->accumulator(), C);
+  }
   else {
 
     /* Calculate fieldValueSum and count move types and connectivity */
     for(i=0;i<RealFields;i++) {
       j=field[f=Board::order[i]];
       if (j == free) continue;
-      if (j == color) {
-	b->countFrom( f, j, cColor );
-	fieldValueSum -= fieldValue[i];
+      if (j == C) {
+	b->countFrom<C>( f, cColor );
+	fieldValueSum -= t.fieldValue[i];
       }
       else {
-	b->countFrom( f, j, cOpponent );
-	fieldValueSum += fieldValue[i];
+	b->countFrom<opponent>( f, cOpponent );
+	fieldValueSum += t.fieldValue[i];
       }
     }
 
@@ -180,20 +277,20 @@ int Evaluator::calcEvaluation(Board* b)
       valueSum = 16000;
     else {
 
-      for(int t=0;t < Move::typeCount;t++)
-	moveValueSum += _evalScheme->moveValue(t) *
-	  (cOpponent.moveCount(t) - cColor.moveCount(t));
+      for(int m=0;m < Move::typeCount;m++)
+	moveValueSum += t.moveValue[m] *
+	  (cOpponent.moveCount(m) - cColor.moveCount(m));
 
       for(int i=0;i < MoveCounter::inARowCount;i++)
-	inARowValueSum += _evalScheme->inARowValue(i) *
+	inARowValueSum += t.inARowValue[i] *
 	  (cOpponent.rowCount(i) - cColor.rowCount(i));
 
-      if (color == color2)
-	stoneValueSum = _evalScheme->stoneValue(14 - color1Count) -
-	  _evalScheme->stoneValue(14 - color2Count);
+      if (C == color2)
+	stoneValueSum = t.stoneValue[14 - color1Count] -
+	  t.stoneValue[14 - color2Count];
       else
-	stoneValueSum = _evalScheme->stoneValue(14 - color2Count) -
-	  _evalScheme->stoneValue(14 - color1Count);
+	stoneValueSum = t.stoneValue[14 - color2Count] -
+	  t.stoneValue[14 - color1Count];
 
       valueSum = fieldValueSum + moveValueSum + inARowValueSum + stoneValueSum;
     }
@@ -213,29 +310,268 @@ int Evaluator::calcEvaluation(Board* b)
   return valueSum;
 }
 
+/**
+ * Batch evaluation
+ *
+ * For each token of a batch position, counts moves and rows like
+ * Board::countFrom(), but without branches: every condition of countFrom
+ * is calculated for all positions, so that the loops over positions
+ * can be vectorized by the compiler (16 positions in one SSE register).
+ */
+
+/* Fields of the line from a field in one direction, and the fields
+ * left/right of its first 3 fields. Fields behind the first one not on
+ * the board are set to field 0, which is never on the board. */
+struct BatchLine {
+  bool open;          /* second field is on the board */
+  short cell[6];      /* cell[k] is k steps from first field */
+  short left[3], right[3];
+};
+static BatchLine batchLine[Board::AllFields][7];
+
+static bool initBatchLines()
+{
+  Board b; /* empty: only fields not on the board are out */
+
+  for(int s=0;s<Board::AllFields;s++) {
+    if (b[s] == Board::out) continue;
+    for(int d=1;d<7;d++) {
+      BatchLine& l = batchLine[s][d];
+      int dir = Board::fieldDiffOfDir(d);
+      int dirL = Board::fieldDiffOfDir(d-1), dirR = Board::fieldDiffOfDir(d+1);
+
+      l.cell[0] = s;
+      for(int k=1;k<6;k++)
+	l.cell[k] = (b[l.cell[k-1]] == Board::out) ? 0 : l.cell[k-1] + dir;
+      for(int k=0;k<3;k++) {
+	bool on = (b[l.cell[k]] != Board::out);
+	l.left[k] = on ? l.cell[k] + dirL : 0;
+	l.right[k] = on ? l.cell[k] + dirR : 0;
+      }
+      l.open = (b[l.cell[1]] != Board::out);
+    }
+  }
+  return true;
+}
+
+enum { batchCounters = Move::typeCount + MoveCounter::inARowCount };
+
+/* For line <l> in all positions of a batch with <C> to move:
+ * add counts of moves/rows of the token on its first field to <diff>
+ * (+1 for opponent token, -1 for own token), and set <ownMoves> if
+ * an own token has a move */
+template<int C>
+static inline void countLine(const BatchLine& l,
+			     const unsigned char (*field)[EvalBatch::lanes],
+			     signed char (*diff)[EvalBatch::lanes],
+			     unsigned char* __restrict ownMoves)
+{
+  const int free = Board::free, out = Board::out;
+  const int opponent = (C == Board::color1) ? Board::color2 : Board::color1;
+  const unsigned char* __restrict a = field[l.cell[0]];
+  const unsigned char* __restrict c1 = field[l.cell[1]];
+  const unsigned char* __restrict c2 = field[l.cell[2]];
+  const unsigned char* __restrict c3 = field[l.cell[3]];
+  const unsigned char* __restrict c4 = field[l.cell[4]];
+  const unsigned char* __restrict c5 = field[l.cell[5]];
+  const unsigned char* __restrict l0 = field[l.left[0]];
+  const unsigned char* __restrict l1 = field[l.left[1]];
+  const unsigned char* __restrict l2 = field[l.left[2]];
+  const unsigned char* __restrict r0 = field[l.right[0]];
+  const unsigned char* __restrict r1 = field[l.right[1]];
+  const unsigned char* __restrict r2 = field[l.right[2]];
+
+  /* conditions are masks (0 or all bits set), so that counting is
+   * a bitwise and with the sign: no control flow */
+  for(int j=0;j<EvalBatch::lanes;j++) {
+    unsigned char t = a[j];
+    unsigned char own = -(t == C);
+    unsigned char opp = -(t == opponent);
+    /* -1 for own token, +1 for opponent, 0 without token */
+    signed char sign = own | (opp & 1);
+    unsigned char u = (own & opponent) | (opp & C);
+
+    unsigned char left = -((l0[j] == free) & (l1[j] == free));
+    unsigned char right = -((r0[j] == free) & (r1[j] == free));
+    unsigned char row2 = -(c1[j] == t);
+    unsigned char with2 = row2 & -(c2[j] == u);
+    unsigned char row3 = row2 & -(c2[j] == t);
+    unsigned char with3 = row3 & -(c3[j] == u);
+    unsigned char twoWith3 = with3 & -(c4[j] == u);
+    unsigned char row4 = row3 & -(c3[j] == t);
+    unsigned char row5 = row4 & -(c4[j] == t);
+
+    unsigned char move1 = -(c1[j] == free);
+    unsigned char left2 = row2 & left;
+    unsigned char right2 = row2 & right;
+    unsigned char move2 = row2 & -(c2[j] == free);
+    unsigned char push1with2 = with2 & -(c3[j] == free);
+    unsigned char out1with2 = with2 & -(c3[j] == out);
+    unsigned char left3 = row3 & left & -(l2[j] == free);
+    unsigned char right3 = row3 & right & -(r2[j] == free);
+    unsigned char move3 = row3 & -(c3[j] == free);
+    unsigned char push1with3 = with3 & -(c4[j] == free);
+    unsigned char out1with3 = with3 & -(c4[j] == out);
+    unsigned char push2 = twoWith3 & -(c5[j] == free);
+    unsigned char out2 = twoWith3 & -(c5[j] == out);
+
+    diff[Move::move1][j] += move1 & sign;
+    diff[Move::left2][j] += left2 & sign;
+    diff[Move::right2][j] += right2 & sign;
+    diff[Move::move2][j] += move2 & sign;
+    diff[Move::push1with2][j] += push1with2 & sign;
+    diff[Move::out1with2][j] += out1with2 & sign;
+    diff[Move::left3][j] += left3 & sign;
+    diff[Move::right3][j] += right3 & sign;
+    diff[Move::move3][j] += move3 & sign;
+    diff[Move::push1with3][j] += push1with3 & sign;
+    diff[Move::out1with3][j] += out1with3 & sign;
+    diff[Move::push2][j] += push2 & sign;
+    diff[Move::out2][j] += out2 & sign;
+    diff[Move::typeCount + MoveCounter::inARow2][j] += row2 & sign;
+    diff[Move::typeCount + MoveCounter::inARow3][j] += row3 & sign;
+    diff[Move::typeCount + MoveCounter::inARow4][j] += row4 & sign;
+    diff[Move::typeCount + MoveCounter::inARow5][j] += row5 & sign;
+
+    ownMoves[j] |= own & (move1 | left2 | right2 | move2 |
+			  push1with2 | out1with2 | left3 | right3 | move3 |
+			  push1with3 | out1with3 | push2 | out2);
+  }
+}
+
+void EvalBatch::start(Board* b)
+{
+  for(int f=0;f<Board::AllFields;f++)
+    memset(_field[f], b->field[f], lanes);
+  _count = 0;
+}
+
+void EvalBatch::add(Board* b, const Move& m)
+{
+  int f[9];
+  int n = b->changedFields(m, f);
+
+  for(int i=0;i<n;i++)
+    _field[f[i]][_count] = b->field[f[i]];
+  _color1Count[_count] = b->color1Count;
+  _color2Count[_count] = b->color2Count;
+  _color = b->color;
+  _count++;
+}
+
+void Evaluator::calcEvaluations(const EvalBatch& batch, int* value) const
+{
+  if (batch._color == color2)
+    calcEvaluations<color2>(batch, value);
+  else
+    calcEvaluations<color1>(batch, value);
+}
+
+template<int C>
+void Evaluator::calcEvaluations(const EvalBatch& batch, int* value) const
+{
+  enum { lanes = EvalBatch::lanes };
+  const int opponent = (C == color1) ? color2 : color1;
+  const EvalTables& t = _tables;
+  alignas(64) signed char diff[batchCounters][lanes];
+  alignas(64) unsigned char ownMoves[lanes];
+  alignas(64) int fieldValueSum[lanes];
+  memset(diff, 0, sizeof(diff));
+  memset(ownMoves, 0, sizeof(ownMoves));
+  memset(fieldValueSum, 0, sizeof(fieldValueSum));
+
+  for(int i=0;i<RealFields;i++) {
+    int s = Board::order[i];
+    const unsigned char* a = batch._field[s];
+    int v = t.fieldValue[i];
+    unsigned char tokens = 0;
+
+    for(int j=0;j<lanes;j++) {
+      fieldValueSum[j] += (a[j] == C) ? -v : (a[j] == opponent) ? v : 0;
+      tokens |= a[j];
+    }
+    /* free in all positions */
+    if (tokens == 0) continue;
+
+    for(int d=1;d<7;d++)
+      if (batchLine[s][d].open)
+	countLine<C>(batchLine[s][d], batch._field, diff, ownMoves);
+  }
+
+  /* same as calcEvaluation */
+  for(int j=0;j<batch._count;j++) {
+    int color1Count = batch._color1Count[j];
+    int color2Count = batch._color2Count[j];
+
+    if (color1Count <9)
+      value[j] = (C==color1) ? 16000 : -16000;
+    else if (color2Count <9)
+      value[j] = (C==color2) ? 16000 : -16000;
+    else if (!ownMoves[j])
+      value[j] = 16000;
+    else {
+      int valueSum = fieldValueSum[j];
+      for(int m=0;m < Move::typeCount;m++)
+	valueSum += t.moveValue[m] * diff[m][j];
+      for(int r=0;r < MoveCounter::inARowCount;r++)
+	valueSum += t.inARowValue[r] * diff[Move::typeCount + r][j];
+      if (C == color2)
+	valueSum += t.stoneValue[14 - color1Count] - t.stoneValue[14 - color2Count];
+      else
+	valueSum += t.stoneValue[14 - color2Count] - t.stoneValue[14 - color1Count];
+      value[j] = valueSum;
+    }
+  }
+}
+
+
+/* Same loop as calcEvaluation, collecting counts instead of values */
+bool Evaluator::features(Board* b, int* x) const
+{
+  int* field = b->fieldArray();
+  int color = b->actColor();
+  int color1Count = b->getColor1Count();
+  int color2Count = b->getColor2Count();
+  MoveCounter cColor, cOpponent;
+
+  if (color1Count <9 || color2Count <9) return false;
+
+  for(int i=0;i<EvalScheme::paramCount;i++)
+    x[i] = 0;
+
+  for(int r=0;r<5;r++)
+    for(int i=ringStart[r];i<ringStart[r]+ringLength[r];i++) {
+      int f = Board::order[i];
+      int j = field[f];
+      if (j == free) continue;
+      if (j == color) {
+	b->countFrom( f, j, cColor );
+	x[r]--;
+      }
+      else {
+	b->countFrom( f, j, cOpponent );
+	x[r]++;
+      }
+    }
+  if (cColor.moveSum() == 0) return false;
+
+  /* stone value of 0 tokens lost is always 0 */
+  int lostColor = 14 - ((color == color1) ? color1Count : color2Count);
+  int lostOpponent = 14 - ((color == color1) ? color2Count : color1Count);
+  if (lostOpponent > 0) x[4 + lostOpponent]++;
+  if (lostColor > 0) x[4 + lostColor]--;
+
+  for(int m=0;m < Move::typeCount;m++)
+    x[10 + m] = cOpponent.moveCount(m) - cColor.moveCount(m);
+  for(int i=0;i < MoveCounter::inARowCount;i++)
+    x[10 + Move::typeCount + i] = cOpponent.rowCount(i) - cColor.rowCount(i);
+
+  return true;
+}
+
 void Evaluator::changeEvaluation()
 {
-  int i,tmp;
-
-  /* innermost ring */
-  tmp=fieldValue[1];
-  for(i=1;i<6;i++)
-    fieldValue[i] = fieldValue[i+1];
-  fieldValue[6] = tmp;
-
-  tmp=fieldValue[7];
-  for(i=7;i<18;i++)
-    fieldValue[i] = fieldValue[i+1];
-  fieldValue[18] = tmp;
-
-  tmp=fieldValue[19];
-  for(i=19;i<36;i++)
-    fieldValue[i] = fieldValue[i+1];
-  fieldValue[36] = tmp;
-
-  /* the outermost ring */
-  tmp=fieldValue[37];
-  for(i=37;i<60;i++)
-    fieldValue[i] = fieldValue[i+1];
-  fieldValue[60] = tmp;
-}
\ No newline at end of file
+  /* rotate each ring by one field; the center stays */
+  _rotation = (_rotation + 1) % 72; /* lcm of ring lengths */
+  setFieldValues();
+}
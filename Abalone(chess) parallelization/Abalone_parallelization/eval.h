@@ -9,7 +9,13 @@
  * Coefficients used for these evaluations are variable.
  *
  * The constructor gets a name, and tries to read the coefficients
- * from a configuration file, if nothing found, use default values
+ * from a configuration file, if nothing found, use default values.
+ * The file has one line per group of coefficients, e.g. the values
+ * for 1..5 tokens lost:
+ *   stoneValue = -800 -1800 -3000 -4400 -6000
+ * ('#' starts a comment; groups not given keep their values).
+ *
+ * Alternatively, an Evaluator can use a neural network (see nnue.h).
  */
 
 
@@ -25,8 +31,16 @@ class EvalScheme
   ~EvalScheme() {}
 
   void setDefaults();
-  void read(char* file);
-  void save(char* file);
+  /* return false if the file can not be read/written, or if it
+   * contains no group of coefficients */
+  bool read(const char* file);
+  bool save(const char* file);
+
+  /* All tunable coefficients as one vector: ring values, stone values
+   * (1..5 tokens lost), move type values, in-a-row values */
+  enum { paramCount = 5 + 5 + Move::typeCount + MoveCounter::inARowCount };
+  int param(int i) const;
+  void setParam(int i, int value);
 
   void setRingValue(int ring, int value);
   void setRingDiff(int ring, int value);
@@ -34,12 +48,12 @@ class EvalScheme
   void setMoveValue(int type, int value);
   void setInARowValue(int stones, int value);
 
-  int ringValue(int r) { return (r>=0 && r<5) ? _ringValue[r] : 0; }
-  int ringDiff(int r) { return (r>0 && r<5) ? _ringDiff[r] : 0; }
-  int stoneValue(int s) { return (s>0 && s<6) ? _stoneValue[s] : 0; }
-  int moveValue(int t)
+  int ringValue(int r) const { return (r>=0 && r<5) ? _ringValue[r] : 0; }
+  int ringDiff(int r) const { return (r>0 && r<5) ? _ringDiff[r] : 0; }
+  int stoneValue(int s) const { return (s>0 && s<6) ? _stoneValue[s] : 0; }
+  int moveValue(int t) const
       { return (t>=0 && t<Move::typeCount) ? _moveValue[t] : 0;}
-  int inARowValue(int s)
+  int inARowValue(int s) const
       { return (s>=0 && s<MoveCounter::inARowCount) ? _inARowValue[s]:0; }
 
  private:
@@ -49,6 +63,52 @@ class EvalScheme
 };
 
 
+/**
+ * Tables derived from an EvalScheme, as used in the hot evaluation loop.
+ *
+ * Built once when the scheme or the rotation changes, and only read
+ * while searching, so one instance can be shared by all search threads.
+ * Aligned to cache lines so that no written data shares a line with it.
+ */
+struct alignas(64) EvalTables
+{
+    int fieldValue[61];    /* indexed like Board::order */
+    int moveValue[Move::typeCount];
+    int inARowValue[MoveCounter::inARowCount];
+    int stoneValue[6];     /* indexed by number of stones lost */
+};
+
+
+/**
+ * Batch of positions with the same color to move, e.g. the children
+ * of one position, stored as structure of arrays: for each field, the
+ * tokens of all positions are consecutive bytes. This way, the batch
+ * evaluation can work on all positions with the same SIMD instructions.
+ */
+class alignas(64) EvalBatch
+{
+ public:
+    enum { lanes = 16 };  /* maximal number of positions */
+
+    EvalBatch() { _count = 0; _color = 0; }
+
+    /* start a batch of children of the position on <b> */
+    void start(Board* b);
+    /* add position on <b>, reached by move <m> from the one given in
+     * start(). Only call if count() < lanes */
+    void add(Board* b, const Move& m);
+    int count() const { return _count; }
+
+ private:
+    friend class Evaluator;
+
+    unsigned char _field[Board::AllFields][lanes];
+    unsigned char _color1Count[lanes], _color2Count[lanes];
+    int _color;  /* color to move in all positions */
+    int _count;
+};
+
+
 class Evaluator
 {
  public:
@@ -62,33 +122,58 @@ class Evaluator
 	   RealFields = 61, /* number of visible fields */
 	   MvsStored = 100 };
 
-    Evaluator();
+    /* uses the default scheme if none is given */
+    Evaluator(EvalScheme* scheme = 0);
 
     /* Evaluation Scheme to use */
     void setEvalScheme( EvalScheme* scheme = 0);
     EvalScheme* evalScheme() { return _evalScheme; }
     void setFieldValues();
 
+    /* Neural network to use instead of the scheme (0: scheme).
+     * Do not call while a search is running. */
+    void setNetwork(const NeuralNet* net) { _net = net; }
+    const NeuralNet* network() const { return _net; }
+
     int minValue() { return -15000; }
     int maxValue() { return  15000; }
 
+    /* Contributions of a position to calcEvaluation() per coefficient
+     * (see EvalScheme::param), without rotation by changeEvaluation():
+     * the value is the sum of <x>[i] * param(i). Returns false for a
+     * decided position, where the value does not depend on the scheme. */
+    bool features(Board*, int* x) const;
+
     /* Calculate a value for actual position
-     * (greater if better for color1) */
-    int calcEvaluation(Board*);
+     * (greater if better for color1).
+     * Does not modify the evaluator: can be called concurrently.
+     * With a network, updates the accumulator of the board */
+    int calcEvaluation(Board*) const;
+
+    /* calcEvaluation() of all positions in <batch> into <value>.
+     * Only possible without a network (see canEvaluateBatch). */
+    bool canEvaluateBatch() const { return _net == 0; }
+    void calcEvaluations(const EvalBatch& batch, int* value) const;
 
     /* Evalution is based on values which can be changed
-     * a little (so computer's moves aren't always the same) */
+     * a little (so computer's moves aren't always the same).
+     * Rotates the field values around the center by one field;
+     * do not call while a search is running. */
     void changeEvaluation();
 
-    void setBoard(Board*);
+    const EvalTables& tables() const { return _tables; }
 
  private:
-    Board* _board;
+    /* calcEvaluation() with color <C> to move */
+    template<int C> int calcEvaluation(Board*) const;
+    template<int C> void calcEvaluations(const EvalBatch&, int*) const;
+
     EvalScheme* _evalScheme;
-    int* field;
+    const NeuralNet* _net;
+    int _rotation;   /* number of changeEvaluation() calls */
 
-    /* ratings; semi constant - are rotated by changeRating() */
-    static int fieldValue[Board::RealFields];
+    /* ratings; semi constant - rebuilt by setFieldValues() */
+    EvalTables _tables;
 };
 
 #endif
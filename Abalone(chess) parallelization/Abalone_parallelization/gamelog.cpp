@@ -0,0 +1,226 @@
+/**
+ * Game logs: compact binary records of played games
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include "gamelog.h"
+#include "board.h"
+
+static const char logMagic[8] = { 'A','B','G','A','M','E','0','1' };
+
+enum { headerSize = 8 + 1 + 2 + 4 + 4 + 16,
+       endOfGame = 0xFFFF };
+
+/* fields on the board, in field number order */
+static int realFields(int* f)
+{
+    Board b;
+    int count = 0;
+
+    b.clear();
+    for(int i=0; i<Board::AllFields; i++)
+	if (b[i] != Board::out) f[count++] = i;
+    return count;
+}
+
+static void putNumber(unsigned char* p, unsigned int v, int bytes)
+{
+    for(int i=0; i<bytes; i++)
+	p[i] = (v >> (8*i)) & 255;
+}
+
+static unsigned int getNumber(const unsigned char* p, int bytes)
+{
+    unsigned int v = 0;
+    for(int i=0; i<bytes; i++)
+	v |= (unsigned int) p[i] << (8*i);
+    return v;
+}
+
+
+GameLogWriter::GameLogWriter()
+{
+    _file = 0;
+    _used = 0;
+    _inGame = false;
+}
+
+bool GameLogWriter::open(const char* file)
+{
+    close();
+    _file = fopen(file, "ab");
+    return _file != 0;
+}
+
+void GameLogWriter::close()
+{
+    if (!_file) return;
+
+    if (_inGame) endGame(Board::empty);
+    flush();
+    fclose(_file);
+    _file = 0;
+}
+
+void GameLogWriter::put(const unsigned char* data, int len)
+{
+    if (_used + len > bufferSize) flush();
+    memcpy(_buffer + _used, data, len);
+    _used += len;
+}
+
+void GameLogWriter::flush()
+{
+    if (_file && (_used > 0)) {
+	fwrite(_buffer, 1, _used, _file);
+	fflush(_file);
+    }
+    _used = 0;
+}
+
+void GameLogWriter::startGame(Board* b)
+{
+    if (!_file) return;
+    if (_inGame) endGame(Board::empty);
+
+    unsigned char h[headerSize];
+    int f[Board::RealFields];
+    int count = realFields(f);
+
+    memcpy(h, logMagic, sizeof(logMagic));
+    h[8] = b->actColor();
+    putNumber(h+9, b->moveNo(), 2);
+    putNumber(h+11, b->msecsToPlay(Board::color1), 4);
+    putNumber(h+15, b->msecsToPlay(Board::color2), 4);
+    memset(h+19, 0, 16);
+    for(int i=0; i<count; i++) {
+	int c = (*b)[f[i]];
+	int v = (c == Board::color1) ? 1 : (c == Board::color2) ? 2 : 0;
+	h[19 + i/4] |= v << (2*(i%4));
+    }
+    put(h, headerSize);
+    _inGame = true;
+}
+
+void GameLogWriter::addMove(const Move& m, int msecs)
+{
+    if (!_file || !_inGame) return;
+
+    unsigned char r[2+5];
+    int len = 2;
+    putNumber(r, m.field | (m.direction << 7) | (m.type << 10), 2);
+
+    /* clock sample: 7 bits per byte */
+    unsigned int v = (msecs > 0) ? msecs : 0;
+    while(v >= 128) {
+	r[len++] = (v & 127) | 128;
+	v >>= 7;
+    }
+    r[len++] = v;
+    put(r, len);
+}
+
+void GameLogWriter::endGame(int state)
+{
+    if (!_file || !_inGame) return;
+
+    unsigned char r[3];
+    putNumber(r, endOfGame, 2);
+    r[2] = state;
+    put(r, 3);
+    _inGame = false;
+    // keep finished games even if the program is killed later
+    flush();
+}
+
+
+bool GameLogReader::open(const char* file)
+{
+    close();
+    _file = fopen(file, "rb");
+    return _file != 0;
+}
+
+void GameLogReader::close()
+{
+    if (_file) fclose(_file);
+    _file = 0;
+    _inGame = false;
+    _result = Board::empty;
+}
+
+bool GameLogReader::nextGame(Board& b)
+{
+    if (!_file) return false;
+
+    /* skip rest of current game */
+    Move m;
+    int msecs;
+    while(_inGame && nextMove(m, msecs));
+
+    unsigned char h[headerSize];
+    if ((fread(h, headerSize, 1, _file) != 1) ||
+	(memcmp(h, logMagic, sizeof(logMagic)) != 0))
+	return false;
+
+    int f[Board::RealFields];
+    int count = realFields(f);
+    int color1Count = 0, color2Count = 0;
+
+    b.clear();
+    for(int i=0; i<count; i++) {
+	int v = (h[19 + i/4] >> (2*(i%4))) & 3;
+	int c = (v == 1) ? Board::color1 : (v == 2) ? Board::color2 : Board::free;
+	b.setField(f[i], c);
+	if (c == Board::color1) color1Count++;
+	if (c == Board::color2) color2Count++;
+    }
+    b.setColor1Count(color1Count);
+    b.setColor2Count(color2Count);
+    b.setActColor(h[8]);
+    b.setMoveNo((short) getNumber(h+9, 2));
+    b.setMSecsToPlay(Board::color1, getNumber(h+11, 4));
+    b.setMSecsToPlay(Board::color2, getNumber(h+15, 4));
+
+    _inGame = true;
+    _result = Board::empty;
+    return true;
+}
+
+bool GameLogReader::nextMove(Move& m, int& msecs)
+{
+    if (!_file || !_inGame) return false;
+
+    unsigned char r[2];
+    if (fread(r, 2, 1, _file) != 1) {
+	_inGame = false;
+	return false;
+    }
+
+    unsigned int word = getNumber(r, 2);
+    if (word == endOfGame) {
+	int c = fgetc(_file);
+	_result = (c == EOF) ? Board::empty : c;
+	_inGame = false;
+	return false;
+    }
+    m.field = word & 127;
+    m.direction = (word >> 7) & 7;
+    m.type = (Move::MoveType) ((word >> 10) & 15);
+
+    unsigned int v = 0;
+    int c, shift = 0;
+    do {
+	c = fgetc(_file);
+	if (c == EOF) {
+	    _inGame = false;
+	    return false;
+	}
+	v |= (unsigned int) (c & 127) << shift;
+	shift += 7;
+    } while((c & 128) && (shift < 32));
+    msecs = v;
+    return true;
+}
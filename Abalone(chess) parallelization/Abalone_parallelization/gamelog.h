@@ -0,0 +1,96 @@
+/**
+ * Game logs: compact binary records of played games
+ *
+ * A log file holds any number of games, one after the other. A game
+ * is a header with its start position, followed by its moves:
+ *
+ *   header: magic "ABGAME01" (8 bytes), color to move (1 byte),
+ *           move number (2 bytes), msecs to play of color1 and color2
+ *           (4 bytes each), and the 61 fields of the board in field
+ *           number order, packed with 2 bits each (16 bytes)
+ *   move:   field (7 bits), direction (3 bits) and type (4 bits) of
+ *           the move in 2 bytes, followed by the clock sample: msecs
+ *           passed since the previous position, with 7 bits per byte,
+ *           the highest bit set if more bytes follow
+ *   end:    2 bytes 0xFFFF, followed by the state of the final
+ *           position (see Board::validState, 1 byte), or
+ *           Board::empty if the game was not played to its end
+ *
+ * Numbers are little-endian. A move takes 3 bytes if played within
+ * 0.128 secs, and 4 bytes within 16 secs. A game whose end was not
+ * written (the program was killed) ends at the end of the file.
+ *
+ * Logs are written by "referee" and "player" (option "-l"), and
+ * searched again by "replay".
+ */
+
+#ifndef GAMELOG_H
+#define GAMELOG_H
+
+#include <stdio.h>
+
+#include "move.h"
+
+class Board;
+
+class GameLogWriter
+{
+ public:
+    GameLogWriter();
+    ~GameLogWriter() { close(); }
+
+    /* append games to <file>; returns false if it can not be opened */
+    bool open(const char* file);
+    /* end a running game as not played to its end, and write
+     * everything buffered */
+    void close();
+    bool isOpen() { return _file != 0; }
+
+    /* start a new game at the position on <b>, ending a running one */
+    void startGame(Board* b);
+    /* move <m> played <msecs> after the previous position */
+    void addMove(const Move& m, int msecs);
+    /* game ended with <state> of its final position */
+    void endGame(int state);
+    bool inGame() { return _inGame; }
+
+    /* write buffered records into the file */
+    void flush();
+
+ private:
+    enum { bufferSize = 4096 };
+
+    void put(const unsigned char* data, int len);
+
+    FILE* _file;
+    unsigned char _buffer[bufferSize];
+    int _used;
+    bool _inGame;
+};
+
+class GameLogReader
+{
+ public:
+    GameLogReader() { _file = 0; _inGame = false; _result = 0; }
+    ~GameLogReader() { close(); }
+
+    bool open(const char* file);
+    void close();
+
+    /* skip to the next game and set its start position into <b>;
+     * returns false at the end of the file or if it is no log */
+    bool nextGame(Board& b);
+    /* next move of the current game and its clock sample; returns
+     * false at the end of the game */
+    bool nextMove(Move& m, int& msecs);
+    /* state of the final position of a game after its last move
+     * (Board::empty if the game was not ended) */
+    int result() { return _result; }
+
+ private:
+    FILE* _file;
+    bool _inGame;
+    int _result;
+};
+
+#endif
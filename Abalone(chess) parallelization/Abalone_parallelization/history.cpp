@@ -0,0 +1,22 @@
+/**
+ * Repetition detection: positions played in current game
+ */
+
+#include "history.h"
+
+void GameHistory::clear()
+{
+    for(int i=0; i<slots; i++)
+	_key[i] = 0;
+    _count = 0;
+}
+
+void GameHistory::add(unsigned long long key)
+{
+    if ((key == 0) || (_count >= slots/2) || contains(key)) return;
+
+    int i = key & (slots-1);
+    while(_key[i] != 0) i = (i+1) & (slots-1);
+    _key[i] = key;
+    _count++;
+}
@@ -0,0 +1,77 @@
+/**
+ * Repetition detection
+ *
+ * GameHistory: keys (see Board::hashKey) of the positions played in the
+ * current game, collected by SearchStrategy::bestMove. It is only read
+ * while searching, so all threads can probe it.
+ *
+ * KeyStack: keys of the positions along the current search path of
+ * one thread, from the root of the search.
+ *
+ * A search scores a move leading to a position found in one of these
+ * as a draw, without searching the subtree below it.
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+class GameHistory
+{
+ public:
+    GameHistory() { clear(); }
+
+    void clear();
+    void add(unsigned long long key);
+    int size() { return _count; }
+
+    bool contains(unsigned long long key) const
+    {
+	if (_count == 0) return false;
+	for(int i = key & (slots-1); _key[i] != 0; i = (i+1) & (slots-1))
+	    if (_key[i] == key) return true;
+	return false;
+    }
+
+ private:
+    /* open addressing; more than twice the positions of a long game */
+    enum { slots = 1024 };
+
+    unsigned long long _key[slots]; // 0: empty slot
+    int _count;
+};
+
+class KeyStack
+{
+ public:
+    enum { maxSize = 64 };
+
+    KeyStack() { _size = 0; }
+
+    void clear() { _size = 0; }
+    void push(unsigned long long key)
+	{ if (_size < maxSize) _key[_size] = key; _size++; }
+    void pop() { _size--; }
+    /* key pushed last: the position searched (path must not be empty) */
+    unsigned long long top() const
+	{ return _key[((_size < maxSize) ? _size : maxSize) - 1]; }
+
+    /**
+     * Does <key> (the position to be pushed next) repeat a position on
+     * the path? Only positions with the same side to move are compared,
+     * and a position can not repeat within less than 4 plies.
+     */
+    bool repeats(unsigned long long key) const
+    {
+	int i = ((_size < maxSize) ? _size : maxSize) - 4;
+	if ((_size - i) % 2) i--;
+	for(; i >= 0; i -= 2)
+	    if (_key[i] == key) return true;
+	return false;
+    }
+
+ private:
+    unsigned long long _key[maxSize];
+    int _size;
+};
+
+#endif
@@ -0,0 +1,277 @@
+/**
+ * Build an opening book
+ *
+ * Expands the opening tree from the start position ply by ply. Every
+ * position of a ply is searched deeply; its best move goes into the
+ * book. The tree is expanded with the best move and the next best
+ * moves by a one-ply evaluation, up to a given branching factor.
+ * Positions of one ply are distributed over OpenMP threads.
+ *
+ * (See book.h for the file format)
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <omp.h>
+
+#include "board.h"
+#include "search.h"
+#include "eval.h"
+#include "book.h"
+
+static Evaluator ev;
+
+static const char* bookFile = "abalone.book";
+static int strategyNo = 0;
+static int strength = 4;
+static int msecsPerSearch = 0;
+static int plies = 8;
+static int branching = 2;
+static bool symmetric = false;
+
+/* key of position, and symmetry mapping it to the stored image */
+static unsigned long long positionKey(Board& b, int& symmetry)
+{
+    symmetry = 0;
+    return symmetric ? b.canonicalKey(&symmetry) : b.hashKey();
+}
+
+
+struct Child {
+    int value;
+    Move m;
+};
+
+static int compareChildren(const void* a, const void* b)
+{
+    return ((const Child*)b)->value - ((const Child*)a)->value;
+}
+
+static int compareKeys(const void* a, const void* b)
+{
+    unsigned long long k1 = *(const unsigned long long*)a;
+    unsigned long long k2 = *(const unsigned long long*)b;
+    return (k1<k2) ? -1 : (k1>k2) ? 1 : 0;
+}
+
+/**
+ * Search position <b>, fill book entry and up to <branching> moves
+ * to expand (best move first). Returns number of moves to expand.
+ */
+static int searchPosition(SearchStrategy* proto, Board& b,
+			  OpeningBook::Entry& e, Move* expand)
+{
+    SearchStrategy* ss = proto->clone();
+    SearchCallbacks sc(0);
+    ss->setMaxDepth(strength);
+    ss->setEvaluator(&ev);
+    ss->setMSecsForSearch(msecsPerSearch);
+    // per-position workers each search with one thread
+    if (omp_in_parallel()) ss->setThreads(1);
+    ss->registerCallbacks(&sc);
+
+    Move best = ss->bestMove(&b);
+
+    int symmetry;
+    e.key = positionKey(b, symmetry);
+    Move stored = Board::symmetricMove(best, symmetry);
+    e.field = stored.field;
+    e.direction = stored.direction;
+    e.type = stored.type;
+    e.value = ss->bestValue();
+    e.depth = strength;
+    e.flags = 0;
+    delete ss;
+
+    if (best.type == Move::none) return 0;
+
+    /* rank other moves by evaluation after playing them */
+    Child children[MoveList::MaxMoves];
+    int count = 0;
+    MoveList list;
+    Move m;
+    b.generateMoves(list);
+    while(list.getNext(m)) {
+	if ((m.field == best.field) && (m.direction == best.direction) &&
+	    (m.type == best.type)) continue;
+	b.playMove(m);
+	children[count].value = ev.calcEvaluation(&b);
+	children[count].m = m;
+	b.takeBack();
+	count++;
+    }
+    qsort(children, count, sizeof(Child), compareChildren);
+
+    int n = 0;
+    expand[n++] = best;
+    for(int i=0; i<count && n<branching; i++)
+	expand[n++] = children[i].m;
+    return n;
+}
+
+static void printHelp(char* prg)
+{
+    printf("Makebook V 0.1\n"
+	   "Build an opening book by deep searches of the opening tree.\n\n");
+    printf("Usage: %s [options]\n\n", prg);
+    printf(" Options:\n"
+	   "  -h / --help      Print this help text\n"
+	   "  -o <file>        Book file to write (default: %s)\n"
+	   "  -s <strategy>    Number of strategy to use for searches (default: %d)\n"
+	   "  -d <strength>    Strength for searches (default: %d)\n"
+	   "  -t <msecs>       Time limit per search (default: none)\n"
+	   "  -n <plies>       Number of plies in book (default: %d)\n"
+	   "  -k <moves>       Moves expanded per position (default: %d)\n"
+	   "  -y               Symmetric book: symmetric positions share entries\n\n",
+	   bookFile, strategyNo, strength, plies, branching);
+
+    printf(" Available search strategies for option '-s':\n");
+    const char** strs = SearchStrategy::strategies();
+    for(int i = 0; strs[i]; i++)
+	printf("  %2d : Strategy '%s'\n", i, strs[i]);
+    printf("\n");
+    exit(1);
+}
+
+static void parseArgs(int argc, char* argv[])
+{
+    int arg=0;
+    while(arg+1<argc) {
+	arg++;
+	if (strcmp(argv[arg],"-h")==0 ||
+	    strcmp(argv[arg],"--help")==0) printHelp(argv[0]);
+	if (strcmp(argv[arg],"-y")==0) {
+	    symmetric = true;
+	    continue;
+	}
+	if (arg+1 >= argc) {
+	    printf("ERROR - Unknown option %s\n", argv[arg]);
+	    printHelp(argv[0]);
+	}
+	if (strcmp(argv[arg],"-o")==0) bookFile = argv[++arg];
+	else if (strcmp(argv[arg],"-s")==0) strategyNo = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-d")==0) strength = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-t")==0) msecsPerSearch = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-n")==0) plies = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-k")==0) branching = atoi(argv[++arg]);
+	else {
+	    printf("ERROR - Unknown option %s\n", argv[arg]);
+	    printHelp(argv[0]);
+	}
+    }
+    if (branching < 1) branching = 1;
+    if (branching > MoveList::MaxMoves) branching = MoveList::MaxMoves;
+}
+
+int main(int argc, char* argv[])
+{
+    parseArgs(argc, argv);
+
+    SearchStrategy* ss = SearchStrategy::create(strategyNo);
+    if (!ss) printHelp(argv[0]);
+
+    int threads = omp_get_max_threads();
+    printf("Building %sbook '%s' with strategy '%s' (strength %d), %d plies, %d moves per position\n",
+	   symmetric ? "symmetric " : "", bookFile, ss->name(), strength, plies, branching);
+
+    /* positions of current ply */
+    int count = 1;
+    Board* level = new Board[1];
+    level[0].begin(Board::color1);
+
+    /* all book entries, and sorted keys of positions already searched */
+    int entryCount = 0, entrySize = 1024;
+    OpeningBook::Entry* entries = (OpeningBook::Entry*)
+	malloc(sizeof(OpeningBook::Entry) * entrySize);
+    unsigned long long* seen = 0;
+    int seenCount = 0;
+
+    struct timeval t1, t2;
+    gettimeofday(&t1,0);
+
+    for(int ply=0; ply<plies && count>0; ply++) {
+	OpeningBook::Entry* e = new OpeningBook::Entry[count];
+	Move* expand = new Move[count * branching];
+	int* expandCount = new int[count];
+
+	bool perPosition = (count >= threads) && (threads > 1);
+	if (perPosition) {
+	    #pragma omp parallel for schedule(dynamic,1)
+	    for(int i=0; i<count; i++)
+		expandCount[i] = searchPosition(ss, level[i], e[i], expand + i*branching);
+	}
+	else {
+	    for(int i=0; i<count; i++)
+		expandCount[i] = searchPosition(ss, level[i], e[i], expand + i*branching);
+	}
+
+	/* collect entries and remember searched positions */
+	int childCount = 0;
+	for(int i=0; i<count; i++) {
+	    if (e[i].type == Move::none) continue;
+	    if (entryCount == entrySize) {
+		entrySize *= 2;
+		entries = (OpeningBook::Entry*)
+		    realloc(entries, sizeof(OpeningBook::Entry) * entrySize);
+	    }
+	    entries[entryCount++] = e[i];
+	    childCount += expandCount[i];
+	}
+	seen = (unsigned long long*)
+	    realloc(seen, sizeof(unsigned long long) * (seenCount + count + childCount));
+	for(int i=0; i<count; i++)
+	    seen[seenCount++] = e[i].key;
+	qsort(seen, seenCount, sizeof(unsigned long long), compareKeys);
+
+	/* next ply: expanded children not searched before */
+	Board* next = new Board[childCount > 0 ? childCount : 1];
+	unsigned long long* nextKeys = seen + seenCount;
+	int nextCount = 0;
+	for(int i=0; i<count; i++) {
+	    for(int j=0; j<expandCount[i]; j++) {
+		Board& b = next[nextCount];
+		b = level[i];
+		b.playMove(expand[i*branching + j]);
+		if (!b.isValid()) continue;
+
+		int symmetry;
+		unsigned long long key = positionKey(b, symmetry);
+		if (bsearch(&key, seen, seenCount, sizeof(unsigned long long), compareKeys))
+		    continue;
+		bool dup = false;
+		for(int k=0; k<nextCount && !dup; k++)
+		    dup = (nextKeys[k] == key);
+		if (dup) continue;
+		nextKeys[nextCount++] = key;
+	    }
+	}
+
+	gettimeofday(&t2,0);
+	int msecs = (1000* t2.tv_sec + t2.tv_usec / 1000) -
+	    (1000* t1.tv_sec + t1.tv_usec / 1000);
+	printf(" Ply %2d: %5d positions searched%s, %6d entries (%d.%03d secs)\n",
+	       ply+1, count, perPosition ? " in parallel" : "",
+	       entryCount, msecs/1000, msecs%1000);
+
+	delete[] e;
+	delete[] expand;
+	delete[] expandCount;
+	delete[] level;
+	level = next;
+	count = nextCount;
+    }
+
+    if (!OpeningBook::write(bookFile, entries, entryCount,
+			    symmetric ? OpeningBook::symmetric : 0)) {
+	printf("ERROR - Can not write book '%s'\n", bookFile);
+	return 1;
+    }
+    printf("Wrote %d entries to '%s'\n", entryCount, bookFile);
+
+    delete[] level;
+    free(entries);
+    free(seen);
+    return 0;
+}
@@ -106,6 +106,9 @@ class MoveList
 	 */
 	bool getNext(Move&, int maxType = Move::none);
 
+	/* Restart iteration of getNext() from the first move */
+	void rewind() { actualType = -1; }
+
  private:
 	Move move[MaxMoves];
 	int  next[MaxMoves];
@@ -159,9 +162,17 @@ class Variation
   /* Clear sequence storage for moves from depth d */
   void clear(int d);
 
+  /* Clear best sequence found at depth d (e.g. when taken from a cache) */
+  void clearRow(int d)
+    { for(int i=d; i>=0 && i<maxDepth; i++) move[d][i].type = Move::none; }
+
+  /* Copy best sequence found at depth d from another variation */
+  void copyRow(int d, Variation& v)
+    { for(int i=d; i>=0 && i<maxDepth; i++) move[d][i] = v.move[d][i]; }
+
   /* Set maximum supported depth */
   void setMaxDepth(int d)
-    { actMaxDepth = (d>maxDepth) ? maxDepth-1 : d; }
+    { actMaxDepth = (d>=maxDepth) ? maxDepth-1 : d; }
 
  private:
   Move move[maxDepth][maxDepth];
@@ -137,16 +137,18 @@ int NetworkLoop::run()
 
             tprev = 0;
             t = timerList;
-            for(;t!=0;tprev=t,t=tnext) {
+            for(;t!=0;t=tnext) {
                 tnext = t->next;
-                if (t->subLeft(&tv2)) {
-                    // remove timer, it could be added again in timeout()
-                    if (tprev) tprev->next = tnext;
-                    else timerList = tnext;
-
-                    if (verbose>1)
-                        printf("NetworkLoop::run: Timeout\n");
+                if (!t->subLeft(&tv2)) {
+                    tprev = t;
+                    continue;
                 }
+                // remove timer, it could be added again in timeout()
+                if (tprev) tprev->next = tnext;
+                else timerList = tnext;
+
+                if (verbose>1)
+                    printf("NetworkLoop::run: Timeout\n");
                 t->timeout(this);
             }
         }
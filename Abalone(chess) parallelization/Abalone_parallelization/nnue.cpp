@@ -0,0 +1,177 @@
+/**
+ * NeuralNet: efficiently updatable neural network evaluation
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "nnue.h"
+#include "board.h"
+
+static const char netMagic[8] = { 'A','B','N','N','U','E','0','1' };
+
+
+NeuralNet::NeuralNet()
+{
+    memset(_ftWeight, 0, sizeof(_ftWeight));
+    memset(_ftBias, 0, sizeof(_ftBias));
+    memset(_l1Weight, 0, sizeof(_l1Weight));
+    memset(_l1Bias, 0, sizeof(_l1Bias));
+    memset(_outWeight, 0, sizeof(_outWeight));
+    _outBias = 0;
+    _loaded = false;
+}
+
+bool NeuralNet::load(const char* file)
+{
+    FILE* f = fopen(file, "rb");
+    if (!f) return false;
+
+    Header h;
+    bool ok = (fread(&h, sizeof(h), 1, f) == 1) &&
+	(memcmp(h.magic, netMagic, sizeof(netMagic)) == 0) &&
+	(h.features == features) && (h.hidden == hidden) &&
+	(h.hidden2 == hidden2);
+
+    /* read into a copy, so that a broken file keeps the network */
+    NeuralNet* n = new NeuralNet;
+    ok = ok &&
+	(fread(n->_ftWeight, sizeof(_ftWeight), 1, f) == 1) &&
+	(fread(n->_ftBias, sizeof(_ftBias), 1, f) == 1) &&
+	(fread(n->_l1Weight, sizeof(_l1Weight), 1, f) == 1) &&
+	(fread(n->_l1Bias, sizeof(_l1Bias), 1, f) == 1) &&
+	(fread(n->_outWeight, sizeof(_outWeight), 1, f) == 1) &&
+	(fread(&n->_outBias, sizeof(_outBias), 1, f) == 1);
+    fclose(f);
+
+    if (ok) {
+	*this = *n;
+	_loaded = true;
+    }
+    delete n;
+    return ok;
+}
+
+bool NeuralNet::save(const char* file) const
+{
+    FILE* f = fopen(file, "wb");
+    if (!f) return false;
+
+    Header h;
+    memcpy(h.magic, netMagic, sizeof(netMagic));
+    h.features = features;
+    h.hidden = hidden;
+    h.hidden2 = hidden2;
+
+    bool ok = (fwrite(&h, sizeof(h), 1, f) == 1) &&
+	(fwrite(_ftWeight, sizeof(_ftWeight), 1, f) == 1) &&
+	(fwrite(_ftBias, sizeof(_ftBias), 1, f) == 1) &&
+	(fwrite(_l1Weight, sizeof(_l1Weight), 1, f) == 1) &&
+	(fwrite(_l1Bias, sizeof(_l1Bias), 1, f) == 1) &&
+	(fwrite(_outWeight, sizeof(_outWeight), 1, f) == 1) &&
+	(fwrite(&_outBias, sizeof(_outBias), 1, f) == 1);
+    if (fclose(f) != 0) ok = false;
+    return ok;
+}
+
+void NeuralNet::refresh(NNAccumulator& acc, const int* field) const
+{
+    for(int p=0; p<2; p++)
+	for(int i=0; i<hidden; i++)
+	    acc.v[p][i] = _ftBias[i];
+
+    for(int f=0; f<fields; f++)
+	if ((field[f] == Board::color1) || (field[f] == Board::color2))
+	    addToken(acc, f, field[f]);
+}
+
+/* add (<sign> 1) or subtract (-1) weight row <w> to/from <v> */
+static inline void updateRow(short* __restrict v, const short* __restrict w, int sign)
+{
+#ifdef __AVX2__
+    for(int i=0; i<NeuralNet::hidden; i+=16) {
+	__m256i a = _mm256_loadu_si256((const __m256i*) (v+i));
+	__m256i b = _mm256_loadu_si256((const __m256i*) (w+i));
+	a = (sign > 0) ? _mm256_add_epi16(a, b) : _mm256_sub_epi16(a, b);
+	_mm256_storeu_si256((__m256i*) (v+i), a);
+    }
+#else
+    // simple loops over rows not aliasing can be vectorized by the compiler
+    if (sign > 0)
+	for(int i=0; i<NeuralNet::hidden; i++) v[i] += w[i];
+    else
+	for(int i=0; i<NeuralNet::hidden; i++) v[i] -= w[i];
+#endif
+}
+
+void NeuralNet::addToken(NNAccumulator& acc, int f, int color) const
+{
+    updateRow(acc.v[0], _ftWeight[feature(0, f, color)], 1);
+    updateRow(acc.v[1], _ftWeight[feature(1, f, color)], 1);
+}
+
+void NeuralNet::removeToken(NNAccumulator& acc, int f, int color) const
+{
+    updateRow(acc.v[0], _ftWeight[feature(0, f, color)], -1);
+    updateRow(acc.v[1], _ftWeight[feature(1, f, color)], -1);
+}
+
+static inline int clip(int v) { return (v < 0) ? 0 : (v > 127) ? 127 : v; }
+
+int NeuralNet::evaluate(const NNAccumulator& acc, int color) const
+{
+    int us = (color == Board::color2) ? 1 : 0;
+    unsigned char in[2*hidden];
+    int h[hidden2];
+
+#ifdef __AVX2__
+    /* clip accumulators of side to move and opponent into bytes */
+    const __m256i max = _mm256_set1_epi8(127);
+    for(int p=0; p<2; p++) {
+	const short* v = acc.v[p ? 1-us : us];
+	for(int i=0; i<hidden; i+=32) {
+	    __m256i a = _mm256_loadu_si256((const __m256i*) (v+i));
+	    __m256i b = _mm256_loadu_si256((const __m256i*) (v+i+16));
+	    // packs works within 128-bit lanes: restore order of elements
+	    __m256i c = _mm256_permute4x64_epi64(_mm256_packus_epi16(a, b), 0xD8);
+	    _mm256_storeu_si256((__m256i*) (in + p*hidden + i), _mm256_min_epu8(c, max));
+	}
+    }
+
+    /* products of unsigned 7-bit and signed 8-bit values can not
+     * saturate the 16-bit pair sums of maddubs */
+    const __m256i ones = _mm256_set1_epi16(1);
+    for(int o=0; o<hidden2; o++) {
+	__m256i sum = _mm256_setzero_si256();
+	for(int i=0; i<2*hidden; i+=32) {
+	    __m256i x = _mm256_loadu_si256((const __m256i*) (in+i));
+	    __m256i w = _mm256_loadu_si256((const __m256i*) (_l1Weight[o]+i));
+	    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(_mm256_maddubs_epi16(x, w), ones));
+	}
+	__m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4E));
+	s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xB1));
+	h[o] = clip((_mm_cvtsi128_si32(s) + _l1Bias[o]) >> 6);
+    }
+#else
+    for(int i=0; i<hidden; i++) {
+	in[i] = clip(acc.v[us][i]);
+	in[hidden+i] = clip(acc.v[1-us][i]);
+    }
+    for(int o=0; o<hidden2; o++) {
+	int sum = _l1Bias[o];
+	for(int i=0; i<2*hidden; i++)
+	    sum += in[i] * _l1Weight[o][i];
+	h[o] = clip(sum >> 6);
+    }
+#endif
+
+    int value = _outBias;
+    for(int o=0; o<hidden2; o++)
+	value += h[o] * _outWeight[o];
+    return value >> 4;
+}
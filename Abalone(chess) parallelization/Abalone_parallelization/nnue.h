@@ -0,0 +1,88 @@
+/**
+ * NeuralNet: efficiently updatable neural network evaluation
+ *
+ * Input features are pairs (field, token is own/opponent), seen from
+ * each of the two colors ("perspectives"); for color2, the board is
+ * rotated by 180 degrees, so that both colors use the same weights.
+ * The first layer is a sum of weight rows of features present, the
+ * "accumulator". A board keeps its accumulator up to date in
+ * playMove/takeBack, so that a leaf evaluation only needs the two
+ * small layers following it:
+ *
+ *   accumulator (2 x hidden, int16; side to move first)
+ *     -> clipped to 0..127 -> hidden2 outputs (int8 weights) >> 6
+ *     -> clipped to 0..127 -> 1 output (int8 weights) >> 4
+ *
+ * The output is the value for the side to move, in the units of
+ * EvalScheme (a lost token is about 800). With AVX2, accumulator
+ * updates and the first dense layer use 256-bit integer instructions;
+ * the scalar fallback gives exactly the same results.
+ *
+ * A weight file is a header followed by the arrays of the network
+ * in the order declared below (little-endian, as in memory), written
+ * by save() or an external training tool.
+ */
+
+#ifndef NNUE_H
+#define NNUE_H
+
+class NNAccumulator;
+
+class NeuralNet
+{
+ public:
+    enum { fields = 121,          // as Board::AllFields
+	   features = 2*fields,   // (field, own/opponent token)
+	   hidden = 64,           // accumulator size of one perspective
+	   hidden2 = 16 };
+
+    NeuralNet();
+
+    /* read weights from file; returns false and keeps the network if
+     * the file is not a weight file for these sizes */
+    bool load(const char* file);
+    bool save(const char* file) const;
+    bool isLoaded() const { return _loaded; }
+
+    /* accumulators of both perspectives for board <field> (see Board) */
+    void refresh(NNAccumulator&, const int* field) const;
+    /* token of <color> is added to / removed from field <f> */
+    void addToken(NNAccumulator&, int f, int color) const;
+    void removeToken(NNAccumulator&, int f, int color) const;
+
+    /* value of position with accumulator <acc> for <color> to move */
+    int evaluate(const NNAccumulator& acc, int color) const;
+
+ private:
+    struct Header {
+	char magic[8];
+	unsigned int features, hidden, hidden2;
+    };
+
+    /* row of feature weights for token of <color> on <f> from <perspective> */
+    static int feature(int perspective, int f, int color)
+	{ if (perspective) f = fields-1 - f;
+	  return 2*f + ((color == perspective+1) ? 0 : 1); }
+
+    short _ftWeight[features][hidden];
+    short _ftBias[hidden];
+    signed char _l1Weight[hidden2][2*hidden];
+    int _l1Bias[hidden2];
+    signed char _outWeight[hidden2];
+    int _outBias;
+
+    bool _loaded;
+};
+
+
+/**
+ * Sum of first layer weights of all features of a board,
+ * for the perspectives of color1 and color2
+ */
+class NNAccumulator
+{
+ public:
+    short v[2][NeuralNet::hidden];
+};
+
+#endif
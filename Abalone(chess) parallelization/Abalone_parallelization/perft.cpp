@@ -0,0 +1,317 @@
+/**
+ * Perft: move generator benchmark and verification
+ *
+ * Counts the leaf nodes of the full game tree up to a given depth,
+ * using Board::generateMoves/playMove/takeBack only. Positions which
+ * are won (a side has less than 9 tokens) are counted as leaves.
+ *
+ * In parallel mode, the work is split into (root move, reply) pairs
+ * which are distributed over OpenMP threads, and subtree counts are
+ * shared between threads via a lockless hash table, so transpositions
+ * are only counted once.
+ *
+ * Counts can be checked against a reference file (see perft-reference),
+ * with lines "<position> <depth> <count>".
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <atomic>
+#include <omp.h>
+
+#include "board.h"
+
+/* positions used if none is given on the command line */
+static const char* defaultPositions[] = {
+    "start", "position-midgame1", "position-midgame2", "position-endgame", 0 };
+
+static int maxDepth = 3;
+static bool parallel = false;
+static int hashMBytes = 64;
+static const char* referenceFile = 0;
+
+/* positions given on command line */
+static const char* positions[20];
+static int positionCount = 0;
+
+
+/**
+ * Hash table for subtree counts
+ *
+ * Entries are written without locks: the key is stored XORed with
+ * the data, so that a torn entry written concurrently by two threads
+ * does not validate on lookup.
+ */
+class PerftHash
+{
+ public:
+    PerftHash(int mbytes);
+    ~PerftHash() { delete[] _entry; }
+
+    bool lookup(unsigned long long key, int depth, unsigned long long& count);
+    void store(unsigned long long key, int depth, unsigned long long count);
+    void clear();
+
+    long long hits() { return _hits; }
+
+ private:
+    struct Entry {
+	std::atomic<unsigned long long> check; // key ^ data
+	std::atomic<unsigned long long> data;  // count << 8 | depth
+    };
+
+    Entry* _entry;
+    unsigned long long _mask;
+    std::atomic<long long> _hits;
+};
+
+PerftHash::PerftHash(int mbytes)
+{
+    unsigned long long n = 1;
+    while(2 * n * sizeof(Entry) <= (unsigned long long) mbytes << 20) n *= 2;
+    _entry = new Entry[n];
+    _mask = n-1;
+    clear();
+}
+
+void PerftHash::clear()
+{
+    for(unsigned long long i=0;i<=_mask;i++) {
+	_entry[i].check.store(0, std::memory_order_relaxed);
+	_entry[i].data.store(0, std::memory_order_relaxed);
+    }
+    _hits = 0;
+}
+
+bool PerftHash::lookup(unsigned long long key, int depth,
+		       unsigned long long& count)
+{
+    Entry& e = _entry[key & _mask];
+    unsigned long long data = e.data.load(std::memory_order_relaxed);
+    unsigned long long check = e.check.load(std::memory_order_relaxed);
+
+    if ((check ^ data) != key) return false;
+    if ((int)(data & 0xff) != depth) return false;
+
+    count = data >> 8;
+    _hits.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+void PerftHash::store(unsigned long long key, int depth,
+		      unsigned long long count)
+{
+    Entry& e = _entry[key & _mask];
+    unsigned long long data = (count << 8) | depth;
+
+    e.check.store(key ^ data, std::memory_order_relaxed);
+    e.data.store(data, std::memory_order_relaxed);
+}
+
+
+/* count leaves of tree with given depth below position of <b> */
+static unsigned long long perft(Board& b, int depth, PerftHash* hash)
+{
+    MoveList list;
+    Move m;
+
+    b.generateMoves(list);
+    if (depth == 1) return list.getLength();
+
+    unsigned long long key = 0, count = 0;
+    if (hash) {
+	key = b.hashKey();
+	if (hash->lookup(key, depth, count)) return count;
+    }
+
+    while(list.getNext(m)) {
+	b.playMove(m);
+	if (!b.isValid())
+	    count++; // game over
+	else
+	    count += perft(b, depth-1, hash);
+	b.takeBack();
+    }
+
+    if (hash) hash->store(key, depth, count);
+    return count;
+}
+
+/* parallel perft: distribute (root move, reply) pairs over threads */
+static unsigned long long perftParallel(Board& b, int depth, PerftHash* hash)
+{
+    MoveList list, list2;
+    Move m, m2;
+    static Move work[MoveList::MaxMoves * MoveList::MaxMoves][2];
+    int workCount = 0;
+    unsigned long long count = 0;
+
+    if (depth < 3) return perft(b, depth, hash);
+
+    /* collect work list; won positions after first move are leaves */
+    b.generateMoves(list);
+    while(list.getNext(m)) {
+	b.playMove(m);
+	if (!b.isValid())
+	    count++;
+	else {
+	    list2.clear();
+	    b.generateMoves(list2);
+	    while(list2.getNext(m2)) {
+		work[workCount][0] = m;
+		work[workCount][1] = m2;
+		workCount++;
+	    }
+	}
+	b.takeBack();
+    }
+
+    #pragma omp parallel for schedule(dynamic,1) reduction(+: count) firstprivate(b)
+    for(int i=0;i<workCount;i++) {
+	b.playMove(work[i][0]);
+	b.playMove(work[i][1]);
+	if (!b.isValid())
+	    count++;
+	else
+	    count += perft(b, depth-2, hash);
+	b.takeBack();
+	b.takeBack();
+    }
+
+    return count;
+}
+
+
+/* reference count for position/depth, 0 if not found */
+static unsigned long long referenceCount(const char* pos, int depth)
+{
+    if (!referenceFile) return 0;
+
+    FILE* f = fopen(referenceFile, "r");
+    if (!f) return 0;
+
+    char line[200], name[100];
+    int d;
+    unsigned long long count, res = 0;
+    while(fgets(line, sizeof(line), f)) {
+	if (line[0] == '#') continue;
+	if (sscanf(line, "%99s %d %llu", name, &d, &count) != 3) continue;
+	if ((d == depth) && (strcmp(name, pos) == 0)) res = count;
+    }
+    fclose(f);
+    return res;
+}
+
+static void printHelp(char* prg)
+{
+    printf("Perft V 0.1\n"
+	   "Count leaf nodes of game tree to verify and time the move generator.\n\n");
+    printf("Usage: %s [options] [<file>|start ...]\n\n"
+	   "  <file>           File containing game position\n"
+	   "  start            Start position\n"
+	   "                   (default: start and shipped positions)\n\n",
+	   prg);
+    printf(" Options:\n"
+	   "  -h / --help      Print this help text\n"
+	   "  -d <depth>       Maximal depth (default: %d)\n"
+	   "  -p               Parallel mode with shared hash table\n"
+	   "  -m <MB>          Size of hash table (default: %d)\n"
+	   "  -c <file>        Check counts against reference file\n\n",
+	   maxDepth, hashMBytes);
+    exit(1);
+}
+
+static void parseArgs(int argc, char* argv[])
+{
+    int arg=0;
+    while(arg+1<argc) {
+	arg++;
+	if (strcmp(argv[arg],"-h")==0 ||
+	    strcmp(argv[arg],"--help")==0) printHelp(argv[0]);
+	if ((strcmp(argv[arg],"-d")==0) && (arg+1<argc)) {
+	    maxDepth = atoi(argv[++arg]);
+	    if (maxDepth<1) maxDepth = 1;
+	    continue;
+	}
+	if (strcmp(argv[arg],"-p")==0) {
+	    parallel = true;
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-m")==0) && (arg+1<argc)) {
+	    hashMBytes = atoi(argv[++arg]);
+	    if (hashMBytes<1) hashMBytes = 1;
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-c")==0) && (arg+1<argc)) {
+	    referenceFile = argv[++arg];
+	    continue;
+	}
+	if (argv[arg][0] == '-') {
+	    printf("ERROR - Unknown option %s\n", argv[arg]);
+	    printHelp(argv[0]);
+	}
+	if (positionCount < 20)
+	    positions[positionCount++] = argv[arg];
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    parseArgs(argc, argv);
+
+    const char** pos = positionCount ? positions : defaultPositions;
+    if (positionCount) positions[positionCount] = 0;
+
+    PerftHash* hash = parallel ? new PerftHash(hashMBytes) : 0;
+    int errors = 0;
+
+    printf("Perft (%s", parallel ? "parallel" : "sequential");
+    if (parallel)
+	printf(", %d threads, %d MB hash", omp_get_max_threads(), hashMBytes);
+    printf(")\n");
+
+    for(int p=0; pos[p]; p++) {
+	Board b;
+	if (!b.loadFile(pos[p])) {
+	    errors++;
+	    continue;
+	}
+	printf("\n%s (%s)\n", pos[p], b.getShortState());
+
+	for(int d=1; d<=maxDepth; d++) {
+	    struct timeval t1, t2;
+	    unsigned long long count;
+
+	    if (hash) hash->clear();
+	    gettimeofday(&t1,0);
+	    count = parallel ? perftParallel(b, d, hash) : perft(b, d, 0);
+	    gettimeofday(&t2,0);
+
+	    double secs = (t2.tv_sec - t1.tv_sec) + (t2.tv_usec - t1.tv_usec) / 1000000.0;
+	    if (secs <= 0) secs = 0.000001;
+
+	    printf("  depth %d: %14llu leaves  %8.3f secs  %8.2f M/s",
+		   d, count, secs, count / secs / 1000000.0);
+	    if (hash) printf("  %lld hash hits", hash->hits());
+
+	    unsigned long long ref = referenceCount(pos[p], d);
+	    if (ref) {
+		if (ref == count)
+		    printf("  OK");
+		else {
+		    printf("  MISMATCH (expected %llu)", ref);
+		    errors++;
+		}
+	    }
+	    printf("\n");
+	}
+    }
+
+    if (referenceFile)
+	printf("\n%s\n", errors ? "Perft check FAILED" : "Perft check passed");
+
+    delete hash;
+    return errors ? 1 : 0;
+}
@@ -14,17 +14,31 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <omp.h>
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
 
 #include "board.h"
 #include "search.h"
 #include "eval.h"
 #include "network.h"
+#include "book.h"
+#include "tt.h"
+#include "solver.h"
+#include "gamelog.h"
+#include "trace.h"
 
 
 /* Global, static vars */
 NetworkLoop l;
 Board myBoard;
 Evaluator ev;
+NeuralNet net;
+EvalScheme scheme(0);
+TranspositionTable tt;
+TacticalSolver solver;
 
 /* Which color to play? */
 int myColor = Board::color1;
@@ -51,9 +65,97 @@ int lport = 23412;
 /* change evaluation after move? */
 bool changeEval = true;
 
+/* file to write search statistics to, as one JSON line per move */
+FILE* jsonFile = 0;
+
+/* weights of neural network, or coefficients of evaluation scheme
+ * (0: built-in scheme) */
+char* evalFile = 0;
+
+/* opening book file (0: none) */
+char* bookFile = 0;
+
+/* size of transposition table in MB (0: none), and file to keep it in */
+int ttMBytes = 0;
+char* ttFile = 0;
+/* key transposition table by symmetry-canonical keys? */
+bool ttSymmetric = false;
+
+/* value of a draw by repetition is -<contempt> for us */
+int contempt = 0;
+
+/* number of best root moves to report in batch analysis */
+int multiPVLines = 1;
+
+/* helper threads of forced-win solver (0: none) */
+int solverThreads = 0;
+
+/* search reproducibly, independent of thread count (see setDeterministic) */
+bool deterministic = false;
+
+/* threads of each search (0: strategy's default) */
+int searchThreads = 0;
+
+/* trace of sampled search nodes (see trace.h), if a file is given,
+ * sampling 1 of <traceRate> nodes */
+SearchTracer tracer;
+char* traceFile = 0;
+int traceRate = 16;
+
+/* batch analysis: file with positions ("-" for stdin), 0 for network play */
+char* analyzeFile = 0;
+
+/* time limit per position in batch analysis (0: only depth limit) */
+int analyzeMSecs = 0;
+
+/* binary log of games played (see gamelog.h), if a file is given */
+GameLogWriter gameLog;
+char* logFile = 0;
+/* position logged last, and when it was seen */
+Board logBoard;
+struct timeval logTime;
+
+/* server mode: number of games played at once (0: one game), and
+ * threads shared by their searches (0: number of processors) */
+int serverGames = 0;
+int poolThreads = 0;
+
 
 
 
+/**
+ * Log position on <b>: as move from the position logged last,
+ * or as start of a new game if not reachable by a move
+ */
+static void logPosition(Board* b)
+{
+    if (!gameLog.isOpen()) return;
+
+    // a position seen again (e.g. sent by a new connection)
+    if (gameLog.inGame() && logBoard.hasSameFields(b) &&
+	(logBoard.actColor() == b->actColor())) return;
+
+    struct timeval now;
+    gettimeofday(&now,0);
+    int msecsPassed =
+	(1000* now.tv_sec + now.tv_usec / 1000) -
+	(1000* logTime.tv_sec + logTime.tv_usec / 1000);
+
+    Move m;
+    if (gameLog.inGame()) m = logBoard.moveToReach(b, true);
+    if (m.type == Move::none)
+	gameLog.startGame(b);
+    else
+	gameLog.addMove(m, msecsPassed);
+    logBoard = *b;
+    logTime = now;
+
+    int state = b->validState();
+    if ((state != Board::valid1) && (state != Board::valid2))
+	gameLog.endGame(state);
+}
+
+
 /**
  * MyDomain
  *
@@ -103,6 +205,7 @@ void MyDomain::received(char* str)
     if (verbose) {
 	printf("\n\n==========================================\n%s", str+4);
     }
+    logPosition(&myBoard);
 
     int state = myBoard.validState();
     if ((state != Board::valid1) && 
@@ -141,9 +244,12 @@ void MyDomain::received(char* str)
 
 	myBoard.playMove(m, msecsPassed);
 	sendBoard(&myBoard);
+	logPosition(&myBoard);
 
-	if (changeEval)
+	if (changeEval) {
 	    ev.changeEvaluation();
+	    tt.invalidateValues();
+	}
 
 	/* stop player at win position */
 	int state = myBoard.validState();
@@ -181,6 +287,603 @@ void MyDomain::newConnection(Connection* c)
     }
 }
 
+/*
+ * Batch analysis
+ *
+ * Read positions in the format of Board::getState() (as logged by
+ * "start"/"referee"), search each one and print best move, value,
+ * principal variation and node counts. With many positions, positions
+ * are distributed over threads (each search running sequentially);
+ * otherwise positions are searched one after the other, with the
+ * strategy's own parallelization.
+ */
+
+/* read positions from <f> into a malloc'ed array, return count */
+static int readPositions(FILE* f, char*** list)
+{
+    char line[256], state[1024];
+    int count = 0, len = 0, borders = 0;
+    *list = 0;
+
+    while(fgets(line, sizeof(line), f)) {
+	bool border = (strstr(line, "-----------") != 0);
+
+	// remember header line "#<moveNo> ..." in front of a board
+	if (borders == 0) {
+	    if (line[0] == '#') {
+		len = snprintf(state, sizeof(state), "%s", line);
+		continue;
+	    }
+	    if (!border) continue;
+	}
+
+	if (len + (int)strlen(line) < (int)sizeof(state))
+	    len += sprintf(state+len, "%s", line);
+	if (border) borders++;
+	if (borders < 2) continue;
+
+	// board complete
+	*list = (char**) realloc(*list, sizeof(char*) * (count+1));
+	(*list)[count++] = strdup(state);
+	len = borders = 0;
+    }
+    return count;
+}
+
+/* search position given as string, write result line into <res>,
+ * add statistics to <sum> */
+static long long analyzePosition(SearchStrategy* proto, char* state,
+				 char* res, int resLen, SearchStats& sum)
+{
+    Board b;
+    if (!b.setState(state)) {
+	snprintf(res, resLen, "can not parse position");
+	return 0;
+    }
+    // times in positions are ignored; use -t for a time limit
+    b.setMSecsToPlay(Board::color1, 0);
+    b.setMSecsToPlay(Board::color2, 0);
+
+    int st = b.validState();
+    if ((st != Board::valid1) && (st != Board::valid2)) {
+	snprintf(res, resLen, "%s", Board::stateDescription(st));
+	return 0;
+    }
+
+    SearchStrategy* ss = proto->clone();
+    SearchCallbacks sc(0);
+    ss->setMaxDepth(maxDepth);
+    ss->setEvaluator(&ev);
+    ss->setMSecsForSearch(analyzeMSecs);
+    ss->setContempt(contempt);
+    ss->setMultiPV(multiPVLines);
+    ss->setDeterministic(deterministic);
+    ss->setThreads(searchThreads);
+    // per-position workers each search with one thread
+    if (omp_in_parallel()) ss->setThreads(1);
+    if (tt.isValid()) ss->setTranspositionTable(&tt);
+    // one solver: only usable if positions are searched one after the other
+    if (solver.threads() && !omp_in_parallel()) ss->setSolver(&solver);
+    // rings are per thread number, which searches in parallel would share
+    if (tracer.isOpen() && !omp_in_parallel()) sc.setTracer(&tracer);
+    ss->registerCallbacks(&sc);
+
+    Move m = ss->bestMove(&b);
+    SearchStats& total = sc.total();
+
+    // Move::name() uses a static buffer
+    #pragma omp critical (moveNames)
+    {
+	sum.add(total);
+	int pos = snprintf(res, resLen, "%c %s value %d leaves %lld nodes %lld msecs %d pv",
+			   (b.actColor() == Board::color1) ? 'O':'X',
+			   m.name(), ss->bestValue(), total.leaves, total.nodes,
+			   sc.msecsPassed());
+	Move* pv = ss->pv();
+	for(int i=0; i<Variation::maxDepth && pv[i].type != Move::none; i++)
+	    if (pos < resLen)
+		pos += snprintf(res+pos, resLen-pos, " %s", pv[i].name());
+
+	// further best moves, if more than one is requested
+	const MultiPV& lines = ss->multiPV();
+	for(int l=0; l<lines.count() && multiPVLines>1; l++) {
+	    const MultiPV::Line& line = lines.line(l);
+	    if (pos < resLen)
+		pos += snprintf(res+pos, resLen-pos, "\n   %d. %s value %d pv",
+				l+1, line.move.name(), line.value);
+	    for(int i=0; i<Variation::maxDepth && line.pv[i].type != Move::none; i++)
+		if (pos < resLen)
+		    pos += snprintf(res+pos, resLen-pos, " %s", line.pv[i].name());
+	}
+    }
+
+    delete ss;
+    return total.leaves;
+}
+
+static int analyze()
+{
+    FILE* f = (strcmp(analyzeFile, "-") == 0) ? stdin : fopen(analyzeFile, "r");
+    if (!f) {
+	printf("ERROR - Can not open '%s' for reading positions\n", analyzeFile);
+	return 1;
+    }
+
+    char** states;
+    int count = readPositions(f, &states);
+    if (f != stdin) fclose(f);
+
+    SearchStrategy* ss = SearchStrategy::create(strategyNo);
+    int threads = omp_get_max_threads();
+    // one table for all positions: positions of a game share subtrees
+    if (ttMBytes > 0) tt.create(ttMBytes, 0, ttSymmetric);
+    solver.setThreads(solverThreads);
+    // a thread count given for searches keeps positions sequential
+    bool perPosition = (searchThreads == 0) && (count >= 2*threads) && (threads > 1);
+
+    printf("Analyzing %d positions with strategy '%s' (depth %d",
+	   count, ss->name(), maxDepth);
+    if (analyzeMSecs>0)
+	printf(", %d.%03d secs", analyzeMSecs/1000, analyzeMSecs%1000);
+    if (perPosition)
+	printf(", %d positions in parallel", threads);
+    printf(") ...\n");
+
+    enum { resLen = 256 * (MultiPV::maxLines + 1) };
+    char* results = (char*) malloc((size_t) count * resLen);
+    long long leaves = 0;
+    SearchStats sum;
+    struct timeval t1, t2;
+
+    gettimeofday(&t1,0);
+    if (perPosition) {
+	#pragma omp parallel for schedule(dynamic,1) reduction(+: leaves)
+	for(int i=0; i<count; i++)
+	    leaves += analyzePosition(ss, states[i], results + i*resLen, resLen, sum);
+    }
+    else {
+	for(int i=0; i<count; i++) {
+	    leaves += analyzePosition(ss, states[i], results + i*resLen, resLen, sum);
+	    printf("%d: %s\n", i+1, results + i*resLen);
+	}
+    }
+    gettimeofday(&t2,0);
+
+    if (perPosition)
+	for(int i=0; i<count; i++)
+	    printf("%d: %s\n", i+1, results + i*resLen);
+
+    int msecsPassed =
+	(1000* t2.tv_sec + t2.tv_usec / 1000) -
+	(1000* t1.tv_sec + t1.tv_usec / 1000);
+    if (msecsPassed<1) msecsPassed = 1;
+    printf("Analyzed %d positions in %d.%03d secs: %.2f positions/s, %lld k leaves/s\n",
+	   count, msecsPassed/1000, msecsPassed%1000,
+	   1000.0 * count / msecsPassed, leaves / msecsPassed);
+    if (tt.isValid())
+	printf("Transposition table (%d MB%s): %lld hits, %.1f%% of probes\n",
+	       tt.mbytes(), tt.isSymmetric() ? ", symmetric keys" : "", sum.ttHits,
+	       100.0 * sum.ttHits / (sum.nodes + sum.ttHits > 0 ? sum.nodes + sum.ttHits : 1));
+
+    for(int i=0; i<count; i++) free(states[i]);
+    free(states);
+    free(results);
+    return 0;
+}
+
+
+/*
+ * Server mode
+ *
+ * One process plays <serverGames> games at once, each with its own
+ * board, evaluator, transposition table and strategy. Game i is played
+ * on port <lport>+10*i (connecting to <rport>+10*i if a host is given),
+ * as a domain uses up to 5 ports on one host (see NetworkDomain).
+ *
+ * Searches of all games share one pool of <threads> threads: at most
+ * <searches> = min(games, threads) searches run at once, each in its own
+ * worker thread with a fixed part of the pool as its OpenMP team (the
+ * worker and threads/searches - 1 team threads). A team keeps its threads
+ * between searches, so the process never has more than <threads> search
+ * threads, and the processors are never oversubscribed. The game with
+ * the least time left on its clock is searched first; time spent waiting
+ * counts against it. Network handling stays in the main thread, which
+ * picks up finished searches with a timer.
+ */
+
+struct ServerGame;
+
+class ServerDomain: public NetworkDomain
+{
+public:
+    ServerDomain(ServerGame* g, int p) : NetworkDomain(p) { game = g; sent = 0; }
+
+    void sendBoard(Board*);
+
+protected:
+    void received(char* str);
+    void newConnection(Connection*);
+
+private:
+    ServerGame* game;
+    Board* sent;
+};
+
+struct ServerGame {
+    int no;
+    ServerDomain* domain;
+    Board board;            // position of the game (main thread only)
+    Board searched;         // copy of it for the search
+    Evaluator ev;
+    TranspositionTable tt;
+    SearchStrategy* ss;
+    SearchCallbacks sc;
+    Move move;              // result of the search
+    int movesLeft;
+    bool ended;
+    /* main thread only: waiting for a search result, when the position
+     * was received, and search to be done again on a newer position */
+    bool searching, restart;
+    struct timeval received;
+    /* state in the pool, protected by its mutex */
+    bool queued, running;
+};
+
+class SearchPool
+{
+public:
+    enum { maxGames = 256, portStep = 10 };
+
+    SearchPool() { _thread = 0; _threads = _searches = 0; _waiting = _finished = 0; _quit = false; }
+
+    /* start workers for at most <searches> searches at once, sharing
+     * <threads> threads */
+    void start(int threads, int searches);
+    /* stop running searches and wait for the threads */
+    void stop();
+    int threads() { return _threads; }
+    int searches() { return _searches; }
+
+    /* search the position of game <g>, received now if <newPosition>;
+     * a running search of it is stopped, and <g> is returned by
+     * finished() with restart set */
+    void submit(ServerGame* g, bool newPosition);
+    /* game with a search finished since the last call, or 0 */
+    ServerGame* finished();
+
+private:
+    void work(int threads);
+    /* msecs left for game <g> to move: the earliest deadline first */
+    int urgency(ServerGame* g);
+
+    std::mutex _mutex;
+    std::condition_variable _wakeup;
+    std::thread* _thread;
+    int _threads, _searches;
+    ServerGame* _waitingGame[maxGames];
+    ServerGame* _finishedGame[maxGames];
+    int _waiting, _finished;
+    bool _quit;
+};
+
+SearchPool pool;
+ServerGame** games = 0;
+
+static int msecsSince(struct timeval& t)
+{
+    struct timeval now;
+    gettimeofday(&now,0);
+    return (1000* now.tv_sec + now.tv_usec / 1000) -
+	(1000* t.tv_sec + t.tv_usec / 1000);
+}
+
+void SearchPool::start(int threads, int searches)
+{
+    _threads = threads;
+    _searches = (searches < threads) ? searches : threads;
+    _thread = new std::thread[_searches];
+    // the team sizes add up to <threads>
+    for(int w=0; w<_searches; w++)
+	_thread[w] = std::thread(&SearchPool::work, this,
+				 _threads / _searches + ((w < _threads % _searches) ? 1:0));
+}
+
+void SearchPool::stop()
+{
+    {
+	std::lock_guard<std::mutex> lock(_mutex);
+	_quit = true;
+	for(int i=0; i<serverGames; i++)
+	    if (games[i]->running) games[i]->ss->stopSearch();
+    }
+    _wakeup.notify_all();
+    for(int w=0; w<_searches; w++)
+	_thread[w].join();
+    delete [] _thread;
+    _thread = 0;
+}
+
+int SearchPool::urgency(ServerGame* g)
+{
+    int ms = g->searched.msecsToPlay(g->searched.actColor());
+    // without a time limit, the game waiting longest is first
+    if (ms <= 0) ms = 1<<30;
+    return ms - msecsSince(g->received);
+}
+
+void SearchPool::submit(ServerGame* g, bool newPosition)
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    if (newPosition) gettimeofday(&g->received,0);
+    if (g->running) {
+	g->restart = true;
+	g->ss->stopSearch();
+	return;
+    }
+    g->searched = g->board;
+    if (!g->queued) {
+	g->queued = true;
+	_waitingGame[_waiting++] = g;
+    }
+    _wakeup.notify_one();
+}
+
+ServerGame* SearchPool::finished()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    while(_finished > 0) {
+	ServerGame* g = _finishedGame[--_finished];
+	// a newer position of the game was submitted meanwhile
+	if (g->queued || g->running) continue;
+	return g;
+    }
+    return 0;
+}
+
+void SearchPool::work(int threads)
+{
+    // the OpenMP team of this worker, kept for all its searches
+    omp_set_dynamic(0);
+    omp_set_num_threads(threads);
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    while(1) {
+	_wakeup.wait(lock, [this] { return _quit || (_waiting > 0); });
+	if (_quit) return;
+
+	int next = 0;
+	for(int i=1; i<_waiting; i++)
+	    if (urgency(_waitingGame[i]) < urgency(_waitingGame[next])) next = i;
+	ServerGame* g = _waitingGame[next];
+	_waitingGame[next] = _waitingGame[--_waiting];
+	g->queued = false;
+	g->running = true;
+
+	// time spent waiting is lost for the search
+	Board& b = g->searched;
+	int c = b.actColor(), ms = b.msecsToPlay(c);
+	if (ms > 0) {
+	    ms -= msecsSince(g->received);
+	    b.setMSecsToPlay(c, (ms < 1) ? 1 : ms);
+	}
+	lock.unlock();
+
+	g->ss->setThreads(threads);
+	g->move = g->ss->bestMove(&b);
+
+	lock.lock();
+	g->running = false;
+	int i = 0;
+	while((i < _finished) && (_finishedGame[i] != g)) i++;
+	if (i == _finished) _finishedGame[_finished++] = g;
+    }
+}
+
+static void gameEnded(ServerGame* g)
+{
+    g->ended = true;
+    for(int i=0; i<serverGames; i++)
+	if (!games[i]->ended) return;
+    l.exit();
+}
+
+/* end game if position on <b> is decided; returns true if so */
+static bool checkEnd(ServerGame* g, Board* b)
+{
+    int state = b->validState();
+    if ((state == Board::valid1) || (state == Board::valid2)) return false;
+
+    printf("[%d] %s\n", g->no, Board::stateDescription(state));
+    switch(state) {
+	case Board::timeout1:
+	case Board::timeout2:
+	case Board::win1:
+	case Board::win2:
+	    gameEnded(g);
+	default:
+	    break;
+    }
+    return true;
+}
+
+/* play the move found by the search of game <g> */
+static void playSearched(ServerGame* g)
+{
+    g->searching = false;
+    if (g->ended) return;
+    if (g->restart) {
+	g->restart = false;
+	if (g->board.actColor() & myColor) {
+	    g->searching = true;
+	    pool.submit(g, false);
+	}
+	return;
+    }
+
+    int msecsPassed = msecsSince(g->received);
+    Move& m = g->move;
+
+    printf("[%d] %s ", g->no, (myColor == Board::color1) ? "O":"X");
+    if (m.type == Move::none) {
+	printf(" can not draw any move ?! Sorry.\n");
+	return;
+    }
+    printf("draws '%s' (after %d.%03d secs)...\n",
+	   m.name(), msecsPassed/1000, msecsPassed%1000);
+
+    g->board.playMove(m, msecsPassed);
+    g->domain->sendBoard(&g->board);
+
+    // no search of this game is running
+    if (changeEval) {
+	g->ev.changeEvaluation();
+	if (g->tt.isValid()) g->tt.invalidateValues();
+    }
+
+    if (checkEnd(g, &g->board)) return;
+
+    g->movesLeft--;
+    if (g->movesLeft == 0) {
+	printf("[%d] Terminating because given number of moves drawn.\n", g->no);
+	g->domain->broadcast("quit\n");
+	gameEnded(g);
+    }
+}
+
+class ServerTimer: public NetworkTimer
+{
+public:
+    ServerTimer() : NetworkTimer(5) {}
+
+protected:
+    void timeout(NetworkLoop*);
+};
+
+void ServerTimer::timeout(NetworkLoop* loop)
+{
+    ServerGame* g;
+    while((g = pool.finished()) != 0)
+	playSearched(g);
+    loop->install(this);
+}
+
+void ServerDomain::sendBoard(Board* b)
+{
+    if (b) {
+	static char tmp[500];
+	sprintf(tmp, "pos %s\n", b->getState());
+	if (verbose) printf("[%d] %s", game->no, tmp+4);
+	broadcast(tmp);
+    }
+    sent = b;
+}
+
+void ServerDomain::received(char* str)
+{
+    if (strncmp(str, "quit", 4)==0) {
+	if (!game->ended) gameEnded(game);
+	return;
+    }
+
+    if (strncmp(str, "pos ", 4)!=0) return;
+    if (game->ended) return;
+
+    Board b;
+    b.setState(str+4);
+    // the position searched for, sent again (e.g. by a new connection)
+    if (game->searching && b.hasSameFields(&game->board) &&
+	(b.actColor() == game->board.actColor()) &&
+	(b.moveNo() == game->board.moveNo())) return;
+
+    // on receiving remote position, do not broadcast own board any longer
+    sent = 0;
+
+    game->board = b;
+    if (verbose) {
+	printf("\n\n==========================================\n[%d] %s",
+	       game->no, str+4);
+    }
+
+    if (checkEnd(game, &game->board)) return;
+
+    if ((game->board.actColor() & myColor) && (game->movesLeft != 0)) {
+	game->searching = true;
+	pool.submit(game, true);
+    }
+}
+
+void ServerDomain::newConnection(Connection* c)
+{
+    NetworkDomain::newConnection(c);
+
+    if (sent) {
+	static char tmp[500];
+	int len = sprintf(tmp, "pos %s\n", sent->getState());
+	c->sendString(tmp, len);
+    }
+}
+
+static int serve(SearchStrategy* proto, OpeningBook* book)
+{
+    if (serverGames > SearchPool::maxGames) serverGames = SearchPool::maxGames;
+    int threads = (poolThreads > 0) ? poolThreads : omp_get_num_procs();
+    if (threads > SearchCallbacks::maxThreads) threads = SearchCallbacks::maxThreads;
+    // the table size is shared out over the games
+    int mbytes = (ttMBytes > 0) ? ttMBytes / serverGames : 0;
+    if ((ttMBytes > 0) && (mbytes < 1)) mbytes = 1;
+
+    pool.start(threads, serverGames);
+    printf("Serving %d games on ports %d-%d (step %d) with %d search threads, "
+	   "%d searches at once",
+	   serverGames, lport, lport + (serverGames - 1) * SearchPool::portStep,
+	   SearchPool::portStep, pool.threads(), pool.searches());
+    if (mbytes > 0) printf(", %d MB transposition table each", mbytes);
+    printf("\n");
+    if (solverThreads > 0 || logFile || jsonFile || tracer.isOpen() || ttFile)
+	printf("WARNING - Solver, game log, JSON output, trace and table file "
+	       "are not used in server mode\n");
+
+    games = new ServerGame*[serverGames];
+    for(int i=0; i<serverGames; i++) {
+	ServerGame* g = new ServerGame;
+	g->no = i+1;
+	g->ev = ev;
+	if (mbytes > 0) g->tt.create(mbytes, 0, ttSymmetric);
+	g->ss = proto->clone();
+	g->ss->setMaxDepth(maxDepth);
+	g->ss->setContempt(contempt);
+	g->ss->setDeterministic(deterministic);
+	g->ss->setEvaluator(&g->ev);
+	g->ss->setBook(book);
+	if (g->tt.isValid()) g->ss->setTranspositionTable(&g->tt);
+	g->ss->registerCallbacks(&g->sc);
+	g->movesLeft = maxMoves;
+	g->ended = g->searching = g->restart = false;
+	g->queued = g->running = false;
+
+	g->domain = new ServerDomain(g, lport + i * SearchPool::portStep);
+	l.install(g->domain);
+	if (host) g->domain->addConnection(host, rport + i * SearchPool::portStep);
+	games[i] = g;
+    }
+
+    ServerTimer timer;
+    l.install(&timer);
+
+    struct timeval t1;
+    gettimeofday(&t1,0);
+    l.run();
+    int msecsPassed = msecsSince(t1);
+    pool.stop();
+
+    if (msecsPassed < 1) msecsPassed = 1;
+    printf("Served %d games in %d.%03d secs: %.1f games per hour\n",
+	   serverGames, msecsPassed/1000, msecsPassed%1000,
+	   3600000.0 * serverGames / msecsPassed);
+    return 0;
+}
+
+
 /*
  * Main program
  */
@@ -202,6 +905,28 @@ void printHelp(char* prg, bool printHeader)
 	   "  -v / -vv         Be verbose / more verbose\n"
 	   "  -s <strategy>    Number of strategy to use for computer (see below)\n"
 	   "  -n               Do not change evaluation function after own moves\n"
+	   "  -j <file>        Append search statistics as JSON lines to file\n"
+	   "  -l <file>        Append games to binary game log (see replay)\n"
+	   "  -b <file>        Use opening book (see makebook)\n"
+	   "  -e <file>        Evaluate with neural network weights or evaluation\n"
+	   "                   scheme coefficients (see tune) from file\n"
+	   "  -m <MB>          Size of transposition table (default: 0, none)\n"
+	   "  --ttfile <file>  Keep transposition table in file, to resume with it\n"
+	   "  -y               Key transposition table by symmetry-canonical keys\n"
+	   "  -f <threads>     Run forced-win solver in helper threads while searching\n"
+	   "  -c <contempt>    Value of repeating a position is -<contempt> (default: 0)\n"
+	   "  --deterministic  Same moves and node counts in each run, with any number\n"
+	   "                   of threads (Minimax only; no solver, no time limit)\n"
+	   "  --threads <n>    Threads of each search (default: strategy's choice;\n"
+	   "                   --server uses --pool)\n"
+	   "  --trace <file>   Append sampled search nodes of each search to file\n"
+	   "                   (Minimax only; see tracestat)\n"
+	   "  --tracerate <n>  Trace 1 of <n> nodes, a power of 2 (default: 16)\n"
+	   "  --analyze <file> Search all positions in file (\"-\": stdin) and exit\n"
+	   "  -t <msecs>       Time limit per position for --analyze\n"
+	   "  -k <lines>       Report best <lines> moves for --analyze (Minimax only)\n"
+	   "  --server <games> Play <games> games at once, on every 10th port from <port>\n"
+	   "  --pool <threads> Threads shared by searches of --server (default: all)\n"
 	   "  -<integer>       Maximal number of moves before terminating\n"
 	   "  -p [host:][port] Connection to broadcast channel\n"
 	   "                   (default: 23412)\n\n");
@@ -233,6 +958,81 @@ void parseArgs(int argc, char* argv[])
 	    changeEval = false;
 	    continue;
 	}
+	if ((strcmp(argv[arg],"-e")==0) && (arg+1<argc)) {
+	    evalFile = argv[++arg];
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-b")==0) && (arg+1<argc)) {
+	    bookFile = argv[++arg];
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-l")==0) && (arg+1<argc)) {
+	    logFile = argv[++arg];
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-m")==0) && (arg+1<argc)) {
+	    ttMBytes = atoi(argv[++arg]);
+	    continue;
+	}
+	if (strcmp(argv[arg],"-y")==0) {
+	    ttSymmetric = true;
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-c")==0) && (arg+1<argc)) {
+	    contempt = atoi(argv[++arg]);
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-f")==0) && (arg+1<argc)) {
+	    solverThreads = atoi(argv[++arg]);
+	    continue;
+	}
+	if (strcmp(argv[arg],"--deterministic")==0) {
+	    deterministic = true;
+	    continue;
+	}
+	if ((strcmp(argv[arg],"--threads")==0) && (arg+1<argc)) {
+	    searchThreads = atoi(argv[++arg]);
+	    continue;
+	}
+	if ((strcmp(argv[arg],"--trace")==0) && (arg+1<argc)) {
+	    traceFile = argv[++arg];
+	    continue;
+	}
+	if ((strcmp(argv[arg],"--tracerate")==0) && (arg+1<argc)) {
+	    traceRate = atoi(argv[++arg]);
+	    continue;
+	}
+	if ((strcmp(argv[arg],"--ttfile")==0) && (arg+1<argc)) {
+	    ttFile = argv[++arg];
+	    continue;
+	}
+	if ((strcmp(argv[arg],"--server")==0) && (arg+1<argc)) {
+	    serverGames = atoi(argv[++arg]);
+	    continue;
+	}
+	if ((strcmp(argv[arg],"--pool")==0) && (arg+1<argc)) {
+	    poolThreads = atoi(argv[++arg]);
+	    continue;
+	}
+	if ((strcmp(argv[arg],"--analyze")==0) && (arg+1<argc)) {
+	    analyzeFile = argv[++arg];
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-k")==0) && (arg+1<argc)) {
+	    multiPVLines = atoi(argv[++arg]);
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-t")==0) && (arg+1<argc)) {
+	    analyzeMSecs = atoi(argv[++arg]);
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-j")==0) && (arg+1<argc)) {
+	    arg++;
+	    jsonFile = fopen(argv[arg], "a");
+	    if (!jsonFile)
+		printf("WARNING - Can not open '%s' for search statistics\n", argv[arg]);
+	    continue;
+	}
 	if ((strcmp(argv[arg],"-s")==0) && (arg+1<argc)) {
 	    arg++;
 	    if (argv[arg][0]>='0' && argv[arg][0]<='9')
@@ -294,13 +1094,80 @@ int main(int argc, char* argv[])
 {
     parseArgs(argc, argv);
 
+    if (evalFile) {
+	if (net.load(evalFile)) {
+	    printf("Using neural network evaluation from '%s'\n", evalFile);
+	    ev.setNetwork(&net);
+	}
+	else if (scheme.read(evalFile)) {
+	    printf("Using evaluation scheme from '%s'\n", evalFile);
+	    ev.setEvalScheme(&scheme);
+	}
+	else
+	    printf("WARNING - Can not read evaluation from '%s'\n", evalFile);
+    }
+
+    if (traceFile) {
+	int shift = 0;
+	while((2 << shift) <= traceRate) shift++;
+	if (tracer.open(traceFile, shift))
+	    printf("Tracing 1 of %d search nodes into '%s'\n", 1 << shift, traceFile);
+	else
+	    printf("WARNING - Can not open '%s' for search trace\n", traceFile);
+    }
+
+    if (analyzeFile) return analyze();
+
     SearchStrategy* ss = SearchStrategy::create(strategyNo);
     ss->setMaxDepth(maxDepth);
+    ss->setContempt(contempt);
+    ss->setDeterministic(deterministic);
+    ss->setThreads(searchThreads);
     printf("Using strategy '%s' (depth %d) ...\n", ss->name(), maxDepth);
 
+    static OpeningBook book;
+    OpeningBook* usedBook = 0;
+    if (bookFile) {
+	if (book.open(bookFile)) {
+	    printf("Using opening book '%s' (%d positions)\n", bookFile, book.size());
+	    usedBook = &book;
+	    ss->setBook(usedBook);
+	}
+	else
+	    printf("WARNING - Can not use '%s' as opening book\n", bookFile);
+    }
+
+    if (serverGames > 0) return serve(ss, usedBook);
+
+    if (ttMBytes > 0) {
+	if (tt.create(ttMBytes, ttFile, ttSymmetric)) {
+	    printf("Using transposition table with %d MB", ttMBytes);
+	    if (ttFile) printf(" in '%s'", ttFile);
+	    if (ttSymmetric) printf(", symmetric keys");
+	    printf("\n");
+	    // evaluation starts unchanged, values from a previous run may not fit
+	    if (changeEval) tt.invalidateValues();
+	    ss->setTranspositionTable(&tt);
+	}
+	else
+	    printf("WARNING - Can not create transposition table\n");
+    }
+
+    if (solverThreads > 0) {
+	solver.setThreads(solverThreads);
+	printf("Using forced-win solver with %d helper threads\n", solverThreads);
+	ss->setSolver(&solver);
+    }
+
     myBoard.setSearchStrategy( ss );
     ss->setEvaluator(&ev);
-    ss->registerCallbacks(new SearchCallbacks(verbose));
+    SearchCallbacks* sc = new SearchCallbacks(verbose);
+    sc->setJSONOutput(jsonFile);
+    if (tracer.isOpen()) sc->setTracer(&tracer);
+    ss->registerCallbacks(sc);
+
+    if (logFile && !gameLog.open(logFile))
+	printf("WARNING - Can not open '%s' for game log\n", logFile);
 
     MyDomain d(lport);
     l.install(&d);
@@ -308,5 +1175,6 @@ int main(int argc, char* argv[])
     if (host) d.addConnection(host, rport);
 
     l.run();
+    gameLog.close();
 
 }
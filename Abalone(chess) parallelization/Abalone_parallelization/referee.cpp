@@ -17,14 +17,23 @@
 
 #include "board.h"
 #include "network.h"
+#include "gamelog.h"
 
 /* Global, static vars */
 static NetworkLoop l;
 static Board myBoard;
 
+/* moves allowed in <myBoard>, indexed after it was sent, so that the
+ * move reaching a received position is found with one lookup */
+static SuccessorKeys successors;
+
 /* Time of last draw */
 static struct timeval t1;
 
+/* positions forwarded, and time spent on them (own overhead per move) */
+static int positionsHandled = 0;
+static long long usecsHandling = 0;
+
 class MyDomain;
 static MyDomain *d1 = 0, *d2 = 0;
 
@@ -61,12 +70,17 @@ static int lport[2] = {DEFAULT_DOMAIN_PORT, DEFAULT_DOMAIN_PORT + DEFAULT_DOMAIN
 /* Where to read position to broadcast from? (0: start position) */
 static FILE* file = 0;
 
+/* binary log of the game (see gamelog.h), if a file is given */
+static GameLogWriter gameLog;
+static char* logFile = 0;
+
 class MyDomain: public NetworkDomain
 {
 public:
     MyDomain(int p) : NetworkDomain(p) { sent = 0; }
 
-    void sendBoard(Board*);
+    /* send <b>, rendered as <state> if given */
+    void sendBoard(Board* b, const char* state = 0);
 
 protected:
     void received(char* str);
@@ -76,11 +90,11 @@ private:
     Board* sent;
 };
 
-void MyDomain::sendBoard(Board* b)
+void MyDomain::sendBoard(Board* b, const char* state)
 {
     if (b) {
 	static char tmp[500];
-	sprintf(tmp, "pos %s\n", b->getState());
+	sprintf(tmp, "pos %s\n", state ? state : b->getState());
 	broadcast(tmp);
     }
     sent = b;
@@ -98,12 +112,18 @@ void MyDomain::received(char* str)
     // on receiving remote position, do not broadcast own board any longer
     sent = 0;
 
+    struct timeval h1, h2;
+    gettimeofday(&h1,0);
+    bool played = false;
+
     if (myBoard.validState() != Board::empty) {
 
 	Board newBoard;
 	newBoard.setState(str+4);
 
-	Move m = myBoard.moveToReach(&newBoard, false);
+	Move m;
+	if (myBoard.canBeFollowedBy(&newBoard))
+	    m = successors.find(&newBoard);
 	if (m.type == Move::none) {
 	    printf("WARNING: Got a board which is not reachable via a valid move !?\n");
 	    return;
@@ -127,22 +147,30 @@ void MyDomain::received(char* str)
 	    }
 	    printf(" draws '%s' (after %d.%03d secs)...\n",
 		   m.name(), msecsPassed/1000, msecsPassed%1000);
+	    gameLog.addMove(m, msecsPassed);
 
 	    if (*pMSecs > msecsPassed)
 		*pMSecs -= msecsPassed;
 	    else
 		*pMSecs = 0;
+
+	    /* same fields as received: no need to parse it again */
+	    myBoard.playMove(m);
+	    myBoard.setActColor(newBoard.actColor());
+	    played = true;
 	}
     }
 
-    myBoard.setState(str+4);
+    if (!played) myBoard.setState(str+4);
     /* force our objective view regarding time */
     myBoard.setMSecsToPlay(Board::color1, msecsToPlay[Board::color1] );
     myBoard.setMSecsToPlay(Board::color2, msecsToPlay[Board::color2] );
 
+    /* rendered once, for output and for the other channel */
+    char* boardState = myBoard.getState();
     int state = myBoard.validState();
     if (showBoard)
-      printf("%s%s\n", myBoard.getState(), Board::stateDescription(state));
+      printf("%s%s\n", boardState, Board::stateDescription(state));
     else
       printf("%s - %s\n", myBoard.getShortState(), Board::stateDescription(state));
 
@@ -151,14 +179,23 @@ void MyDomain::received(char* str)
 	case Board::timeout2:
 	case Board::win1:
 	case Board::win2:
+	    gameLog.endGame(state);
 	    l.exit();
 	default:
 	    break;
     }
 
     /* send to other domain */
-    if (d1 == this) if (d2) d2->sendBoard(&myBoard);
-    if (d2 == this) if (d1) d1->sendBoard(&myBoard);
+    if (d1 == this) if (d2) d2->sendBoard(&myBoard, boardState);
+    if (d2 == this) if (d1) d1->sendBoard(&myBoard, boardState);
+
+    /* index moves while the other side is thinking */
+    successors.build(myBoard);
+
+    gettimeofday(&h2,0);
+    positionsHandled++;
+    usecsHandling += (1000000LL * h2.tv_sec + h2.tv_usec) -
+	(1000000LL * h1.tv_sec + h1.tv_usec);
 }
 
 void MyDomain::newConnection(Connection* c)
@@ -198,6 +235,7 @@ static void printHelp(char* prg, bool printHeader)
 	   "  -v / -vv         Be verbose / more verbose\n"
 	   "  -n               Do not show board\n"
 	   "  -t <timeToPlay>  Start in tournament modus (limited time)\n"
+	   "  -l <file>        Append game to binary game log (see replay)\n"
 	   "  -p [host:][port] Connection to first (second) broadcast channel\n"
 	   "                   (default: %d / %d)\n\n",
 	   DEFAULT_DOMAIN_PORT, DEFAULT_DOMAIN_PORT + DEFAULT_DOMAIN_DIFF);
@@ -235,6 +273,10 @@ static void parseArgs(int argc, char* argv[])
 		}
 		continue;
 	    }
+	    if ((strcmp(argv[arg],"-l")==0) && (arg+1<argc)) {
+		logFile = argv[++arg];
+		continue;
+	    }
 	    if ((strcmp(argv[arg],"-p")==0) && (arg+1<argc)) {
 		arg++;
 		if (domainsSet>1) {
@@ -287,13 +329,7 @@ int main(int argc, char* argv[])
     myBoard.setVerbose(verbose);
 
     if (file) {
-	char tmp[500];
-	int len = 0, c;
-	while( len<499 && (c=fgetc(file)) != EOF)
-	    tmp[len++] = (char) c;
-	tmp[len++]=0;
-
-	if (!myBoard.setState(tmp)) {
+	if (!myBoard.readState(file)) {
 	    printf("%s: WARNING - Can not parse given position; using start position\n", argv[0]);
 	    myBoard.begin(Board::color1);
 	}
@@ -312,6 +348,13 @@ int main(int argc, char* argv[])
     myBoard.setMSecsToPlay(Board::color1, msecsToPlay[Board::color1] );
     myBoard.setMSecsToPlay(Board::color2, msecsToPlay[Board::color2] );
 
+    if (logFile) {
+	if (gameLog.open(logFile))
+	    gameLog.startGame(&myBoard);
+	else
+	    printf("%s: WARNING - Can not open '%s' for game log\n", argv[0], logFile);
+    }
+
     /*
      * Register domains at NetworkLoop.
      */
@@ -331,6 +374,7 @@ int main(int argc, char* argv[])
     /* send board to both domains */
     d1->sendBoard(&myBoard);
     d2->sendBoard(&myBoard);
+    successors.build(myBoard);
 
     int state = myBoard.validState();
     if (showBoard)
@@ -338,5 +382,10 @@ int main(int argc, char* argv[])
     else
       printf("%s - %s\n", myBoard.getShortState(), Board::stateDescription(state));
 
-    return l.run();
+    int res = l.run();
+    gameLog.close();
+    if (positionsHandled > 0)
+	printf("Referee overhead: %lld usecs per position (%d positions)\n",
+	       usecsHandling / positionsHandled, positionsHandled);
+    return res;
 }
@@ -0,0 +1,237 @@
+/**
+ * Replay games of a game log
+ *
+ * Reads games logged by "referee" or "player" (see gamelog.h) and
+ * searches every position of these games again, in the order played,
+ * as the player would. For each position, the searched move is printed
+ * with value, time and node counts, and finally the sums over all
+ * positions. This allows to compare search changes on real games.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "board.h"
+#include "search.h"
+#include "eval.h"
+#include "tt.h"
+#include "gamelog.h"
+
+static Evaluator ev;
+static NeuralNet net;
+static EvalScheme scheme(0);
+static TranspositionTable tt;
+
+static char* logFile = 0;
+static char* evalFile = 0;
+static int strategyNo = 0;
+static int strength = 3;
+static int msecsPerSearch = 0;
+static int ttMBytes = 64;
+static int onlyGame = 0;
+static bool quiet = false;
+static bool deterministic = false;
+static int searchThreads = 0;
+
+static void printHelp(char* prg)
+{
+    printf("Replay V 0.1\n"
+	   "Search all positions of logged games again, reporting time and nodes per move.\n\n");
+    printf("Usage: %s [options] <file>\n\n"
+	   "  <file>           Game log written by referee/player with \"-l\"\n\n", prg);
+    printf(" Options:\n"
+	   "  -h / --help      Print this help text\n"
+	   "  -s <strategy>    Number of strategy to use for searches (default: %d)\n"
+	   "  -d <strength>    Strength for searches (default: %d)\n"
+	   "  -t <msecs>       Time limit per search (default: none)\n"
+	   "  -m <MB>          Size of transposition table (default: %d, 0: none)\n"
+	   "  -e <file>        Evaluate with neural network weights or evaluation\n"
+	   "                   scheme coefficients from file\n"
+	   "  -g <game>        Only replay game with this number (starting at 1)\n"
+	   "  --deterministic  Search reproducibly, independent of thread count\n"
+	   "  --threads <n>    Threads of each search (default: strategy's choice)\n"
+	   "  -q               Only print sums per game\n\n",
+	   strategyNo, strength, ttMBytes);
+
+    printf(" Available search strategies for option '-s':\n");
+    const char** strs = SearchStrategy::strategies();
+    for(int i = 0; strs[i]; i++)
+	printf("  %2d : Strategy '%s'\n", i, strs[i]);
+    printf("\n");
+    exit(1);
+}
+
+static void parseArgs(int argc, char* argv[])
+{
+    int arg=0;
+    while(arg+1<argc) {
+	arg++;
+	if (strcmp(argv[arg],"-h")==0 ||
+	    strcmp(argv[arg],"--help")==0) printHelp(argv[0]);
+	if (strcmp(argv[arg],"-q")==0) {
+	    quiet = true;
+	    continue;
+	}
+	if (strcmp(argv[arg],"--deterministic")==0) {
+	    deterministic = true;
+	    continue;
+	}
+	if (argv[arg][0] != '-') {
+	    logFile = argv[arg];
+	    continue;
+	}
+	if (arg+1 >= argc) {
+	    printf("ERROR - Unknown option %s\n", argv[arg]);
+	    printHelp(argv[0]);
+	}
+	if (strcmp(argv[arg],"-s")==0) strategyNo = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-d")==0) strength = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-t")==0) msecsPerSearch = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-m")==0) ttMBytes = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-e")==0) evalFile = argv[++arg];
+	else if (strcmp(argv[arg],"-g")==0) onlyGame = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"--threads")==0) searchThreads = atoi(argv[++arg]);
+	else {
+	    printf("ERROR - Unknown option %s\n", argv[arg]);
+	    printHelp(argv[0]);
+	}
+    }
+    if (!logFile) printHelp(argv[0]);
+}
+
+/* sums over searches */
+struct ReplayStats {
+    int positions, sameMoves;
+    long long msecs, nodes, leaves;
+
+    ReplayStats() { positions = sameMoves = 0; msecs = nodes = leaves = 0; }
+    void add(const ReplayStats& s) {
+	positions += s.positions; sameMoves += s.sameMoves;
+	msecs += s.msecs; nodes += s.nodes; leaves += s.leaves;
+    }
+    void print(const char* what) {
+	int n = (positions > 0) ? positions : 1;
+	long long ms = (msecs > 0) ? msecs : 1;
+	printf("%s: %d positions, %lld.%03lld secs, %lld msecs/move, %lld nodes/move, "
+	       "%lld k leaves/s, played move found in %d (%.1f%%)\n",
+	       what, positions, msecs/1000, msecs%1000, msecs/n, nodes/n,
+	       leaves/ms, sameMoves, 100.0 * sameMoves / n);
+    }
+};
+
+static bool sameMove(const Move& a, const Move& b)
+{
+    return (a.field == b.field) && (a.direction == b.direction) && (a.type == b.type);
+}
+
+/* search all positions of the game just started in <log> at <b> */
+static void replayGame(GameLogReader& log, Board& b, SearchStrategy* ss,
+		       SearchCallbacks& sc, ReplayStats& stats)
+{
+    Move played;
+    int msecsPlayed;
+
+    if (tt.isValid()) tt.clear();
+
+    while(log.nextMove(played, msecsPlayed)) {
+	// times in logged positions are ignored; use -t for a time limit
+	Board s = b;
+	s.setMSecsToPlay(Board::color1, 0);
+	s.setMSecsToPlay(Board::color2, 0);
+
+	Move m = ss->bestMove(&s);
+	SearchStats& total = sc.total();
+
+	stats.positions++;
+	stats.msecs += sc.msecsPassed();
+	stats.nodes += total.nodes;
+	stats.leaves += total.leaves;
+	if (sameMove(m, played)) stats.sameMoves++;
+
+	if (!quiet) {
+	    // Move::name() uses a static buffer
+	    printf(" #%-3d %c played %-10s", b.moveNo(),
+		   (b.actColor() == Board::color1) ? 'O':'X', played.name());
+	    printf(" (%d.%03d secs) searched %-10s value %6d msecs %6d nodes %9lld leaves %10lld\n",
+		   msecsPlayed/1000, msecsPlayed%1000, m.name(), ss->bestValue(),
+		   sc.msecsPassed(), total.nodes, total.leaves);
+	}
+
+	// only moves allowed in the position can be played
+	MoveList list;
+	b.generateMoves(list);
+	if (!list.isElement(played, 0)) {
+	    printf("ERROR - Move '%s' not allowed; rest of game skipped\n", played.name());
+	    break;
+	}
+	b.playMove(played);
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    parseArgs(argc, argv);
+
+    if (evalFile) {
+	if (net.load(evalFile)) {
+	    printf("Using neural network evaluation from '%s'\n", evalFile);
+	    ev.setNetwork(&net);
+	}
+	else if (scheme.read(evalFile)) {
+	    printf("Using evaluation scheme from '%s'\n", evalFile);
+	    ev.setEvalScheme(&scheme);
+	}
+	else
+	    printf("WARNING - Can not read evaluation from '%s'\n", evalFile);
+    }
+
+    GameLogReader log;
+    if (!log.open(logFile)) {
+	printf("ERROR - Can not open '%s' for reading games\n", logFile);
+	return 1;
+    }
+
+    SearchStrategy* ss = SearchStrategy::create(strategyNo);
+    if (!ss) printHelp(argv[0]);
+    SearchCallbacks sc(0);
+    ss->setMaxDepth(strength);
+    ss->setEvaluator(&ev);
+    ss->setMSecsForSearch(msecsPerSearch);
+    ss->setDeterministic(deterministic);
+    ss->setThreads(searchThreads);
+    ss->registerCallbacks(&sc);
+    if (ttMBytes > 0) {
+	if (tt.create(ttMBytes))
+	    ss->setTranspositionTable(&tt);
+	else
+	    printf("WARNING - Can not create transposition table\n");
+    }
+
+    printf("Replaying games of '%s' with strategy '%s' (strength %d",
+	   logFile, ss->name(), strength);
+    if (msecsPerSearch>0)
+	printf(", %d.%03d secs", msecsPerSearch/1000, msecsPerSearch%1000);
+    printf(") ...\n");
+
+    ReplayStats total;
+    Board b;
+    int games = 0;
+    while(log.nextGame(b)) {
+	games++;
+	if (onlyGame && (games != onlyGame)) continue;
+
+	char what[64];
+	ReplayStats stats;
+	printf("Game %d:\n", games);
+	replayGame(log, b, ss, sc, stats);
+	snprintf(what, sizeof(what), " Game %d (%s)", games,
+		 (log.result() == Board::empty) ? "not ended" :
+		 Board::stateDescription(log.result()));
+	stats.print(what);
+	total.add(stats);
+    }
+
+    total.print("Total");
+    return 0;
+}
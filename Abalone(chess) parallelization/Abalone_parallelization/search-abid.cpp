@@ -9,6 +9,7 @@
 
 #include "search.h"
 #include "board.h"
+#include "tt.h"
 
 class ABIDStrategy: public SearchStrategy
 {
@@ -17,6 +18,7 @@ class ABIDStrategy: public SearchStrategy
     SearchStrategy* clone() { return new ABIDStrategy(); }
 
     Move& nextMove() { return _pv[1]; }
+    Move* pv() { return _pv.chain(0); }
 
  private:
     void searchBestMove();
@@ -28,6 +30,8 @@ class ABIDStrategy: public SearchStrategy
     Move _currentBestMove;
     bool _inPV;
     int _currentMaxDepth;
+    /* positions on current search path */
+    KeyStack _path;
 };
 
 
@@ -45,7 +49,9 @@ void ABIDStrategy::searchBestMove()
     _pv.clear(_maxDepth);
     _currentBestMove.type = Move::none;
     _currentMaxDepth=1;
-    
+    _path.clear();
+    _path.push(_board->hashKey());
+
     /* iterative deepening loop */
     do {
 
@@ -105,7 +111,8 @@ void ABIDStrategy::searchBestMove()
 /*
  * Alpha/Beta search
  *
- * - first, start with principal variation
+ * - first, start with principal variation, then with move from
+ *   transposition table
  * - depending on depth, we only do depth search for some move types
  */
 int ABIDStrategy::alphabeta(int depth, int alpha, int beta)
@@ -114,6 +121,11 @@ int ABIDStrategy::alphabeta(int depth, int alpha, int beta)
     Move m;
     MoveList list;
     bool depthPhase, doDepthSearch;
+    int played = 0;
+    int alpha0 = alpha, remaining = _currentMaxDepth - depth;
+    unsigned long long key = 0, childKey;
+    int symmetry = 0;
+    Move ttMove;
 
     /* We make a depth search for the following move types... */
     int maxType = (depth < _currentMaxDepth-1)  ? Move::maxMoveType :
@@ -122,6 +134,17 @@ int ABIDStrategy::alphabeta(int depth, int alpha, int beta)
 
     _board->generateMoves(list);
 
+    /* cached result; not while following the principal variation */
+    if (_tt && (remaining > 0)) {
+	key = _tt->key(_board, symmetry);
+	if (_tt->probe(key, symmetry, remaining, alpha, beta, value, ttMove) &&
+	    !_inPV && (depth > 0)) {
+	    if (_sc) _sc->stats().ttHits++;
+	    _pv.clearRow(depth);
+	    return value;
+	}
+    }
+
     if (_sc && _sc->verbose()) {
 	    char tmp[100];
 	    sprintf(tmp, "Alpha/Beta [%d;%d], %d moves (%d depth)", alpha, beta,
@@ -139,6 +162,9 @@ int ABIDStrategy::alphabeta(int depth, int alpha, int beta)
 
 	if (m.type == Move::none) _inPV = false;
     }
+    if ((m.type == Move::none) && (ttMove.type != Move::none) &&
+	list.isElement(ttMove, 0, true))
+	m = ttMove;
 
     // first, play all moves with depth search
     depthPhase = true;
@@ -156,6 +182,8 @@ int ABIDStrategy::alphabeta(int depth, int alpha, int beta)
 	doDepthSearch = depthPhase && (m.type <= maxType);
 
 	_board->playMove(m);
+	played++;
+	childKey = _board->hashKey();
 
 	/* check for a win position first */
 	if (!_board->isValid()) {
@@ -163,13 +191,20 @@ int ABIDStrategy::alphabeta(int depth, int alpha, int beta)
 	    /* Shorter path to win position is better */
 	    value = 14999-depth;
 	}
+	else if (isRepetition(childKey, _path)) {
+
+	    /* cycle: draw, no need to search further */
+	    value = drawValue(depth);
+	}
 	else {
 
             if (doDepthSearch) {
 		/* opponent searches for its maximum; but we want the
 		 * minimum: so change sign (for alpha/beta window too!)
 		 */
+		_path.push(childKey);
 		value = -alphabeta(depth+1, -beta, -alpha);
+		_path.pop();
             }
             else {
 		value = evaluate();
@@ -184,12 +219,19 @@ int ABIDStrategy::alphabeta(int depth, int alpha, int beta)
 	    _pv.update(depth, m);
 
 	    if (_sc) _sc->foundBestMove(depth, m, currentValue);
-	    if (depth == 0)
-		    _currentBestMove = m;
+	    if (depth == 0) {
+		_currentBestMove = m;
+		_bestValue = currentValue;
+	    }
 
 	    /* alpha/beta cut off or win position ... */
 	    if (currentValue>14900 || currentValue >= beta) {
-		if (_sc) _sc->finishedNode(depth, _pv.chain(depth));
+		if (_tt && (remaining > 0) && !_stopSearch && (currentValue <= 14900))
+		    _tt->store(key, symmetry, remaining, currentValue, TranspositionTable::lower, m);
+		if (_sc) {
+		    if (currentValue >= beta) _sc->stats().cutoffs++;
+		    _sc->finishedNode(depth, _pv.chain(depth), played);
+		}
 		return currentValue;
 	    }
 
@@ -200,8 +242,15 @@ int ABIDStrategy::alphabeta(int depth, int alpha, int beta)
 	if (_stopSearch) break; // depthPhase=false;
 	m.type = Move::none;
     }
+
+    /* win positions depend on depth: do not cache */
+    if (_tt && (remaining > 0) && !_stopSearch &&
+	(currentValue > -14900) && (currentValue < 14900))
+	_tt->store(key, symmetry, remaining, currentValue,
+		   (currentValue > alpha0) ? TranspositionTable::exact : TranspositionTable::upper,
+		   *_pv.chain(depth));
     
-    if (_sc) _sc->finishedNode(depth, _pv.chain(depth));
+    if (_sc) _sc->finishedNode(depth, _pv.chain(depth), played);
 
     return currentValue;
 }
@@ -0,0 +1,351 @@
+/**
+ * Monte Carlo Tree Search (MCTS) strategy
+ *
+ * All threads descend into one shared tree, selecting children by UCT.
+ * A thread descending into a child adds a virtual loss to it, so that
+ * other threads prefer different paths until the result is known.
+ * Tree nodes come from a pool allocated once: the tree grows without
+ * calling malloc, and children of a node are stored in one block.
+ *
+ * Leaves of the tree are scored by a playout:
+ * - "MCTS": some random moves, then the position is evaluated
+ * - "MCTS-AB": a short alpha/beta search using the evaluator
+ *
+ * Strength gives the number of playouts in units of 5000,
+ * if not limited by time.
+ */
+
+#include <stdio.h>
+#include <math.h>
+#include <sys/time.h>
+#include <atomic>
+#include <omp.h>
+
+#include "search.h"
+#include "board.h"
+#include "eval.h"
+
+class MCTSStrategy: public SearchStrategy
+{
+ public:
+    MCTSStrategy(const char* n, bool abRollouts, int prio)
+	: SearchStrategy(n, prio)
+	{ _abRollouts = abRollouts; _pool = 0; _poolUsed = 0; }
+    ~MCTSStrategy() { delete[] _pool; }
+
+    SearchStrategy* clone()
+	{ return new MCTSStrategy(name(), _abRollouts, 0); }
+
+    Move* pv() { return _pvMoves; }
+
+ private:
+    enum { poolSize = 1<<21,      // nodes in pool (64 MB)
+	   maxPath = 64,          // maximal depth of tree
+	   virtualLoss = 3,       // visits added while descending
+	   playoutsPerLevel = 5000,
+	   randomPlies = 8,       // random moves in a playout
+	   rolloutDepth = 2 };    // depth of alpha/beta rollouts
+
+    struct Node {
+	Move move;                     // move leading to this node
+	std::atomic<int> visits;       // including virtual losses
+	std::atomic<long long> score;  // sum of results (in 1/1000), for player of <move>
+	std::atomic<int> children;     // first child in pool, or unexpanded/expanding
+	int childCount;
+    };
+    enum { unexpanded = -1, expanding = -2 };
+
+    void searchBestMove();
+
+    Node* newNodes(int count);
+    void initNode(Node*, const Move&);
+    /* expand <n> at depth <d> with position <b>;
+     * false if expanded by another thread or pool is exhausted */
+    bool expand(Node* n, int d, Board& b, SearchStats&);
+    Node* select(Node* n);
+    /* one descent with playout and backpropagation */
+    void iterate(Board& root, unsigned long long& seed, SearchStats&);
+
+    /* playout result in [0;1] from view of side to move */
+    double playout(Board& b, unsigned long long& seed);
+    int rollout(Board& b, int depth, int alpha, int beta);
+
+    bool _abRollouts;
+    Node* _pool;
+    std::atomic<int> _poolUsed;
+    Node _root;
+    std::atomic<long long> _playouts;
+    long long _maxPlayouts;
+    Move _pvMoves[Variation::maxDepth];
+};
+
+
+/* map evaluation to win probability, and back */
+static const double evalScale = 500.0;
+
+static inline double winProbability(int eval)
+{
+    return 1.0 / (1.0 + exp(-eval / evalScale));
+}
+
+static inline int probabilityEval(double p)
+{
+    if (p < 0.001) p = 0.001;
+    if (p > 0.999) p = 0.999;
+    return (int) (evalScale * log(p / (1.0 - p)));
+}
+
+/* xorshift64: each thread has its own seed */
+static inline unsigned int nextRandom(unsigned long long& x)
+{
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return (unsigned int) (x >> 32);
+}
+
+
+MCTSStrategy::Node* MCTSStrategy::newNodes(int count)
+{
+    if (_poolUsed.load(std::memory_order_relaxed) + count > poolSize) return 0;
+    int first = _poolUsed.fetch_add(count);
+    if (first + count > poolSize) return 0;
+    return _pool + first;
+}
+
+void MCTSStrategy::initNode(Node* n, const Move& m)
+{
+    n->move = m;
+    n->visits.store(0, std::memory_order_relaxed);
+    n->score.store(0, std::memory_order_relaxed);
+    n->childCount = 0;
+    n->children.store(unexpanded, std::memory_order_relaxed);
+}
+
+bool MCTSStrategy::expand(Node* n, int d, Board& b, SearchStats& stats)
+{
+    int c = unexpanded;
+    if (!n->children.compare_exchange_strong(c, expanding)) return false;
+
+    MoveList list;
+    Move m;
+    b.generateMoves(list);
+    int count = list.getLength();
+    Node* nodes = newNodes(count);
+    if (!nodes) {
+	// pool exhausted: node stays a leaf
+	n->children.store(unexpanded);
+	return false;
+    }
+
+    for(int i=0; list.getNext(m); i++)
+	initNode(nodes + i, m);
+    n->childCount = count;
+    n->children.store((int)(nodes - _pool), std::memory_order_release);
+
+    stats.finishedNode(d, count);
+    return true;
+}
+
+/* UCT: child with best upper confidence bound */
+MCTSStrategy::Node* MCTSStrategy::select(Node* n)
+{
+    Node* child = _pool + n->children.load(std::memory_order_acquire);
+    double logN = log((double) n->visits.load(std::memory_order_relaxed) + 1);
+    Node* best = child;
+    double bestValue = -1;
+
+    for(int i=0; i<n->childCount; i++, child++) {
+	int visits = child->visits.load(std::memory_order_relaxed);
+	if (visits == 0) return child;
+
+	double value = child->score.load(std::memory_order_relaxed) / (1000.0 * visits) +
+	    0.7 * sqrt(logN / visits);
+	if (value > bestValue) {
+	    bestValue = value;
+	    best = child;
+	}
+    }
+    return best;
+}
+
+void MCTSStrategy::iterate(Board& root, unsigned long long& seed, SearchStats& stats)
+{
+    Board b = root;
+    Node* path[maxPath];
+    int len = 0;
+    Node* n = &_root;
+    double result = -1; // from view of side to move at end of path
+
+    /* selection: descend while expanded, adding virtual losses */
+    while(1) {
+	if (n->children.load(std::memory_order_acquire) < 0) {
+	    if ((len == maxPath) || !expand(n, len, b, stats)) break;
+	}
+	if (n->childCount == 0) break;
+
+	n = select(n);
+	n->visits.fetch_add(virtualLoss, std::memory_order_relaxed);
+	path[len++] = n;
+	b.playMove(n->move);
+
+	if (!b.isValid()) {
+	    /* side to move lost */
+	    result = 0;
+	    break;
+	}
+	if (n->visits.load(std::memory_order_relaxed) == virtualLoss) break; // new node
+    }
+
+    if (result < 0) result = playout(b, seed);
+    stats.leaves++;
+
+    /* backpropagation: results alternate between players */
+    double r = 1.0 - result;
+    for(int i=len-1; i>=0; i--) {
+	path[i]->score.fetch_add((long long)(1000 * r), std::memory_order_relaxed);
+	path[i]->visits.fetch_add(1 - virtualLoss, std::memory_order_relaxed);
+	r = 1.0 - r;
+    }
+    _root.visits.fetch_add(1, std::memory_order_relaxed);
+}
+
+double MCTSStrategy::playout(Board& b, unsigned long long& seed)
+{
+    if (_abRollouts)
+	return winProbability(rollout(b, rolloutDepth, -20000, 20000));
+
+    MoveList list;
+    Move m;
+    int plies = 0;
+
+    for(; plies<randomPlies; plies++) {
+	list.clear();
+	b.generateMoves(list);
+	int l = list.getLength();
+	if (l == 0) break;
+
+	int j = nextRandom(seed) % l;
+	do list.getNext(m, Move::none); while(j-- > 0);
+
+	b.playMove(m);
+	if (!b.isValid()) {
+	    /* player of last move won */
+	    return (plies % 2 == 0) ? 1.0 : 0.0;
+	}
+    }
+
+    /* evaluation is from view of player of last move */
+    int eval = _ev->calcEvaluation(&b);
+    return (plies % 2 == 1) ? winProbability(eval) : winProbability(-eval);
+}
+
+/* alpha/beta search, value from view of side to move */
+int MCTSStrategy::rollout(Board& b, int depth, int alpha, int beta)
+{
+    if (depth == 0)
+	return -_ev->calcEvaluation(&b);
+
+    MoveList list;
+    Move m;
+    int best = -20000, value;
+
+    /* only pushing moves are searched at the last level */
+    int maxType = (depth > 1) ? Move::maxMoveType : Move::maxPushType;
+    b.generateMoves(list);
+    if (list.count(maxType) == 0) return -_ev->calcEvaluation(&b);
+
+    while(list.getNext(m, maxType)) {
+	b.playMove(m);
+	if (!b.isValid())
+	    value = 16000;
+	else
+	    value = -rollout(b, depth-1, -beta, -alpha);
+	b.takeBack();
+
+	if (value > best) {
+	    best = value;
+	    if (best >= beta) break;
+	    if (best > alpha) alpha = best;
+	}
+    }
+    return best;
+}
+
+void MCTSStrategy::searchBestMove()
+{
+    if (!_pool) _pool = new Node[poolSize];
+    _poolUsed = 0;
+    initNode(&_root, Move());
+    _playouts = 0;
+    _maxPlayouts = (long long) ((_maxDepth > 0) ? _maxDepth : 4) * playoutsPerLevel;
+
+    int threads = (_threads > 0) ? _threads : omp_get_max_threads();
+    if (threads > SearchCallbacks::maxThreads) threads = SearchCallbacks::maxThreads;
+
+    struct timeval t1, t2;
+    gettimeofday(&t1, 0);
+
+    #pragma omp parallel num_threads(threads)
+    {
+	int t = omp_get_thread_num();
+	SearchStats stats;
+	unsigned long long seed = 0x9E3779B97F4A7C15ULL * (t+1) + _board->hashKey();
+
+	while(1) {
+	    long long p = _playouts.fetch_add(1, std::memory_order_relaxed);
+	    if (p >= _maxPlayouts) break;
+	    if (_sc && ((stats.leaves % 64) == 63) && _sc->timeIsUp()) break;
+	    if (_stopSearch || (_sc && _sc->stopRequested())) break;
+
+	    iterate(*_board, seed, stats);
+	}
+	if (_sc) _sc->stats(t).add(stats);
+    }
+    gettimeofday(&t2, 0);
+
+    /* best move: most visited child of root, same for principal variation */
+    Node* n = &_root;
+    int len = 0;
+    while((len < Variation::maxDepth) && (n->children.load() >= 0) && (n->childCount > 0)) {
+	Node* child = _pool + n->children.load();
+	Node* best = child;
+	for(int i=1; i<n->childCount; i++)
+	    if (child[i].visits.load() > best->visits.load()) best = child + i;
+	if (best->visits.load() == 0) break;
+
+	if (len == 0) {
+	    _bestMove = best->move;
+	    _bestValue = probabilityEval(best->score.load() / (1000.0 * best->visits.load()));
+	    if (_sc) _sc->foundBestMove(0, _bestMove, _bestValue);
+	}
+	_pvMoves[len++] = best->move;
+	n = best;
+    }
+    if (len < Variation::maxDepth) _pvMoves[len].type = Move::none;
+
+    // stopped before any child of the root was visited
+    if (_bestMove.type == Move::none) {
+	MoveList list;
+	Move m;
+	_board->generateMoves(list);
+	if (list.getNext(m)) {
+	    _bestMove = m;
+	    _pvMoves[0] = m;
+	    _pvMoves[1].type = Move::none;
+	}
+    }
+
+    if (_sc && _sc->verbose()) {
+	double secs = (t2.tv_sec - t1.tv_sec) + (t2.tv_usec - t1.tv_usec) / 1000000.0;
+	if (secs <= 0) secs = 0.000001;
+	long long playouts = _root.visits.load();
+	printf("  MCTS: %lld playouts in %.3f secs, %.0f playouts/s per thread (%d threads), %d nodes\n",
+	       playouts, secs, playouts / secs / threads, threads,
+	       (int) _poolUsed.load());
+    }
+}
+
+// register ourselve as search strategies
+MCTSStrategy mctsStrategy("MCTS", false, 6);
+MCTSStrategy mctsABStrategy("MCTS-AB", true, 7);
@@ -9,10 +9,12 @@
 #include "search.h"
 #include "board.h"
 #include "eval.h"
+#include "tt.h"
+#include "trace.h"
 #include <sys/time.h>
 #include <stdio.h>
 #include <omp.h>
-#include <cstring>
+#include <atomic>
 
 /**
  * To create your own search strategy:
@@ -33,25 +35,105 @@ class MinimaxStrategy : public SearchStrategy
 {
 public:
     // Defines the name of the strategy
-    MinimaxStrategy() : SearchStrategy("Minimax") {}
+    MinimaxStrategy() : SearchStrategy("Minimax")
+    {
+        for(int t=0; t<SearchCallbacks::maxThreads; t++) _context[t] = 0;
+    }
+    ~MinimaxStrategy();
 
     // Factory method: just return a new instance of this class
     SearchStrategy *clone() { return new MinimaxStrategy(); }
 
+    Move* pv() { return _pv.chain(0); }
+
 private:
     /**
      * Implementation of the strategy.
      */
     void searchBestMove();
+    /* split root into (move, reply) pairs if fewer moves than this times threads */
+    enum { splitFactor = 2 };
+    /* deterministic search: root moves searched with the same bound, and
+     * replies searched with the same beta; fixed, independent of threads */
+    enum { rootGroup = 16, replyWave = 8 };
+
+    /**
+     * Everything a search thread writes to: allocated by the thread itself
+     * on first use (so that its pages are local to the thread's NUMA node),
+     * and aligned to cache lines so that no two threads share one.
+     * The evaluator is shared, as it is only read.
+     */
+    struct alignas(64) SearchContext {
+        Board board;
+        SearchStats stats;   // merged into callbacks at end of search
+        Variation pv;        // best sequence of current root move
+        KeyStack path;       // keys of positions on current search path
+        EvalBatch leaves;    // children of a node at the last ply
+        TraceRing* trace;    // sampled nodes, if traced (0: none)
+    };
+    /* context of calling thread <t>, with a copy of <b> and cleared counters */
+    SearchContext& startThread(int t, const Board& b);
+    /* merge counters of <threads> contexts into callbacks; returns leaves */
+    int finishThreads(int threads);
+
     /* recursive minimax search top layer*/
     int minimaxPar(char depth, Board tempBoard, int& numberOfEval);
-    /* recursive minimax search */
-    int minimaxSeq(char depth, Board * tempBoard, Evaluator * ev, int alpha, int beta, int& numberOfEval);
-    //check if same fields
-    bool isSameFields(int* field1, int* field2);
+    /* top layer searching (root move, reply) pairs in parallel */
+    int minimaxSplit(char depth, Board& tempBoard, Move* moves, int nMoves, int& numberOfEval, int threads);
+    /* replies to each of the <nMoves> root <moves>, MoveList::MaxMoves apart
+     * in <replyMoves>, and their count; returns the maximal count */
+    int generateReplies(Board& tempBoard, Move* moves, int nMoves, Move* replyMoves, int* replyCount);
+
+    /* state of a root move in deterministic search */
+    struct RootResult {
+        int value;         // minimum over replies searched
+        int reply;         // index of the reply giving it
+        int done;          // replies searched
+        int alpha, beta;   // window for its replies in the next wave
+        Variation pv;
+    };
+    /* a (root move, reply) pair, by index */
+    struct Pair {
+        short root, reply;
+    };
+    /* top layer of deterministic search: (root move, reply) pairs in waves */
+    int minimaxOrdered(char depth, Board& tempBoard, Move* moves, int nMoves, int& numberOfEval, int threads);
+    /* search root moves <from> to <to>-1 in waves of replies, each with
+     * the minimum of the waves before as beta */
+    void searchRoots(char depth, Board& tempBoard, Move* moves, Move* replyMoves, int* replyCount,
+                     int maxReplies, int from, int to, RootResult* result, Pair* pairs,
+                     int& numberOfEval, int threads);
+    /* search <count> <pairs> in parallel, keeping the minimum per root move */
+    void searchPairs(char depth, Board& tempBoard, Move* moves, Move* replyMoves,
+                     Pair* pairs, int count, RootResult* result, int& numberOfEval, int threads);
+    /* recursive minimax search in position of <c.board>, counting into <c.stats>,
+     * best sequence into <c.pv>, with keys of positions searched before in <c.path>.
+     * <maximize> is true at even depth (our move): the compiler generates one
+     * version for each side, without branches on the side in the move loop.
+     * Likewise, only the <traced> version counts leaves for <c.trace> */
+    template<bool maximize, bool traced>
+    int minimaxSeq(char depth, int alpha, int beta, SearchContext& c);
+    /* search child position of <c.board> with hash <key> at <depth>, unless
+     * it is a repetition */
+    template<bool maximize>
+    int searchChild(char depth, int alpha, int beta, unsigned long long key, SearchContext& c);
+    /* value of leaf position of <c.board> from our view */
+    template<bool maximize>
+    int leafValue(SearchContext& c);
+    /* values of the next (at most EvalBatch::lanes) leaf children of <c.board>
+     * at <depth> from our view, evaluated as one batch. The children are
+     * <ttMove> if <ttFirst> is set, followed by the next moves of <list>.
+     * Returns the number of children put into <moves> and <values> */
+    template<bool maximize>
+    int leafValues(char depth, MoveList& list, bool& ttFirst, Move& ttMove,
+                   SearchContext& c, Move* moves, int* values);
+    /* store node result (<value>, window from view of side to move) into _tt */
+    void storeResult(unsigned long long key, int symmetry, int remaining, int value, int alpha, int beta, Move* best);
+    /* poll time after a leaf; true if search should stop */
+    bool stopAfterLeaf(SearchStats& stats);
 
     //last best Evaluation
-    int _lastBestEval;
+    int _lastBestEval{0};
 
     /* prinicipal variation found in last search */
     Variation _pv;
@@ -62,23 +144,17 @@ private:
     char _adaptiveDepth{5};
     //ownMoveNumber that counts only the moves it played, opponent moves not inclusive
     short _ownMoveNumber{1};
-    //2move prior board field array
-    int _field2Prior[121];
-    //1move prior board field array
-    int _field1Prior[121];
-    //2move prior move
-    Move _move2Prior;
-    //1move prior move
-    Move _move1Prior;
+    //key of root position
+    unsigned long long _rootKey;
+    //per-thread search state, indexed by OpenMP thread number
+    SearchContext* _context[SearchCallbacks::maxThreads];
 };
 
-bool MinimaxStrategy::isSameFields(int* field1, int field2[121])
-{
-    for(int i = 0; i < 121; i++) {
-        if ( field1[i] != field2[i] ) return false;
-    }
 
-    return true;
+MinimaxStrategy::~MinimaxStrategy()
+{
+    for(int t=0; t<SearchCallbacks::maxThreads; t++)
+        delete _context[t];
 }
 
 
@@ -88,29 +164,34 @@ void MinimaxStrategy::searchBestMove()
     int numberOfEval = 0;
 
     gettimeofday(&t1, 0);
-    //if this board has occured throw the same move again
-    if(_ownMoveNumber >= 3 && isSameFields(_board->fieldArray(), _field2Prior)){
-        //throw the same move again
-        _bestMove = _move2Prior;
-        printf("Thrown prior move\n");
-    }
-    else{ //do minimax
-
-        if(_remainingTime < 4) _adaptiveDepth = 3;
-        else if(_remainingTime < 10) _adaptiveDepth = 4;
-        else if(_lastBestEval < -900) _adaptiveDepth = 6;
-        else if(_remainingTime > 20 && _lastBestEval < -400) _adaptiveDepth = 6;
-        else _adaptiveDepth = 5;
-        //_adaptiveDepth = _maxDepth;
-
-        // main minimax calculations
-        omp_set_dynamic(0);
-        omp_set_num_threads(48);
-        _lastBestEval = minimaxPar(0, *_board, numberOfEval); // depth start at 0 and goes till _adaptiveDepth (_adaptiveDepth is the depth of the leaf nodes)
-
+    bool verbose = _sc && _sc->verbose();
+
+    _pv.clear(1);
+    _rootKey = _board->hashKey();
+
+    // fixed depth if a strength was given
+    if(_maxDepth > 0) _adaptiveDepth = (_maxDepth < SearchStats::maxDepth) ? _maxDepth : SearchStats::maxDepth-1;
+    else if(_remainingTime < 4) _adaptiveDepth = 3;
+    else if(_remainingTime < 10) _adaptiveDepth = 4;
+    else if(_lastBestEval < -900) _adaptiveDepth = 6;
+    else if(_remainingTime > 20 && _lastBestEval < -400) _adaptiveDepth = 6;
+    else _adaptiveDepth = 5;
+    //_adaptiveDepth = _maxDepth;
+
+    // main minimax calculations
+    omp_set_dynamic(0);
+    omp_set_num_threads((_threads > 0) ? _threads : 48);
+    // entries stored by other threads depend on timing
+    TranspositionTable* tt = _tt;
+    if (_deterministic) _tt = 0;
+    _lastBestEval = minimaxPar(0, *_board, numberOfEval); // depth start at 0 and goes till _adaptiveDepth (_adaptiveDepth is the depth of the leaf nodes)
+    _tt = tt;
+
+    if (verbose) {
         printf("final best Eval = %d\n", _lastBestEval);
         printf("Number of Evaluations = %d\n", numberOfEval);
     }
+
     gettimeofday(&t2, 0);
 
     double usecsPassed =
@@ -118,21 +199,64 @@ void MinimaxStrategy::searchBestMove()
         (1000000.0 * t1.tv_sec + t1.tv_usec);
 
     // printf("Microseconds passed = %f\n", usecsPassed);
-    printf("Evaluations per second = %f * 10^6\n", numberOfEval / usecsPassed);
     _remainingTime -= (usecsPassed/1000000.0 + 0.02); //0.02s for safety
-    printf("AdaptDepth = %d, Remain time = %fs, OwnMoveNumber = %d\n", (int)_adaptiveDepth, _remainingTime, _ownMoveNumber);
-
-    //save the last 2 board positions and corresponding moves for rapid deployment of prior move
-    if(_ownMoveNumber >= 2){
-        std::memcpy(_field2Prior, _field1Prior, sizeof(_field1Prior));
-        std::memcpy(_field1Prior, _board->fieldArray(), sizeof(_field1Prior));
-        _move2Prior = _move1Prior;
-        _move1Prior = _bestMove;
+    if (verbose) {
+        printf("Evaluations per second = %f * 10^6\n", numberOfEval / usecsPassed);
+        printf("AdaptDepth = %d, Remain time = %fs, OwnMoveNumber = %d\n", (int)_adaptiveDepth, _remainingTime, _ownMoveNumber);
     }
 
     _ownMoveNumber++;
 }
 
+/**
+ * Core utilisation in percent for work items with given cost (leaves),
+ * when handed out in order to <threads> threads (dynamic scheduling).
+ * Modeled from the costs, as measured times are distorted if there
+ * are less cores than threads.
+ */
+static int utilisation(const long long* cost, int items, int threads)
+{
+    long long busy[SearchCallbacks::maxThreads] = {0};
+    long long sum = 0, makespan = 1;
+
+    for(int k=0; k<items; k++) {
+        int t = 0;
+        for(int i=1; i<threads; i++)
+            if (busy[i] < busy[t]) t = i;
+        busy[t] += cost[k];
+        sum += cost[k];
+    }
+    for(int t=0; t<threads; t++)
+        if (busy[t] > makespan) makespan = busy[t];
+    return (int) (100 * sum / (makespan * threads));
+}
+
+MinimaxStrategy::SearchContext& MinimaxStrategy::startThread(int t, const Board& b)
+{
+    // first touch by the owning thread places the context in its local memory
+    if (!_context[t]) _context[t] = new SearchContext;
+
+    SearchContext& c = *_context[t];
+    c.board = b;
+    c.stats.clear();
+    c.trace = (_sc && _sc->tracer()) ? _sc->tracer()->ring(t) : 0;
+    return c;
+}
+
+int MinimaxStrategy::finishThreads(int threads)
+{
+    long long leaves = 0;
+    for(int t=0; t<threads; t++) {
+        if (!_context[t]) continue;
+        SearchStats& stats = _context[t]->stats;
+        leaves += stats.leaves;
+        if (_sc) _sc->stats(t).add(stats);
+        // threads not taking part in the next region must not count twice
+        stats.clear();
+    }
+    return (int) leaves;
+}
+
 int MinimaxStrategy::minimaxPar(char depth, Board tempBoard, int& numberOfEval)
 {
     bool maximizeTurn = true; //1st move is always our move, so we maximize it
@@ -150,95 +274,617 @@ int MinimaxStrategy::minimaxPar(char depth, Board tempBoard, int& numberOfEval)
         list.getNext(moves[i]);
     }
 
-    // loop over all moves
-    #pragma omp parallel for schedule(dynamic,1) reduction(+: numberOfEval) shared(bestEval) firstprivate(tempBoard)
-    for(int i=0; i<nMoves; i++)
+    int threads = omp_get_max_threads();
+    if (threads > SearchCallbacks::maxThreads) threads = SearchCallbacks::maxThreads;
+
+    if (_deterministic)
+        return minimaxOrdered(depth, tempBoard, moves, nMoves, numberOfEval, threads);
+
+    // too few root moves to keep all threads busy: split at depth 1
+    if ((nMoves < splitFactor * threads) && (_adaptiveDepth > depth + 1)) {
+        return minimaxSplit(depth, tempBoard, moves, nMoves, numberOfEval, threads);
+    }
+
+    // leaves of each root move, to report utilisation
+    long long cost[150] = {0};
+
+    // value of the k-th best root move found so far (with one line: the best
+    // one) is the bound for all further root moves
+    int k = _multiPVLines;
+    std::atomic<int> bound(-35000);
+
+    // loop over all moves; each thread works in its own context
+    #pragma omp parallel num_threads(threads)
     {
-        Move m = moves[i];
-        int eval;
-        Evaluator ev;
-        
-        // draw move, evaluate, and restore position
-        tempBoard.playMove(m);
-        eval = minimaxSeq(depth + 1, &tempBoard, &ev, -35000, 35000, numberOfEval);
-        tempBoard.takeBack();
-        if (eval > bestEval)
+        SearchContext& c = startThread(omp_get_thread_num(), tempBoard);
+
+        #pragma omp for schedule(dynamic,1)
+        for(int i=0; i<nMoves; i++)
         {
+            Move m = moves[i];
+            int eval;
+
+            if (_sc && _sc->stopRequested()) continue;
+
+            // draw move, evaluate, and restore position
+            long long leaves = c.stats.leaves;
+            c.path.clear();
+            c.path.push(_rootKey);
+            c.pv.clear(_adaptiveDepth - 1);
+            int alpha = bound.load(std::memory_order_relaxed);
+            unsigned long long key = c.board.playMoveKey(m, _rootKey);
+            eval = searchChild<false>(depth + 1, alpha, 35000, key, c);
+            c.board.takeBack();
+
+            cost[i] = c.stats.leaves - leaves;
+            // result of an interrupted search is not reliable
+            if (_sc && _sc->stopRequested()) continue;
+            // not better than k-th best move: value only is an upper bound
+            if (eval <= alpha) continue;
+
             #pragma omp critical
             {
-            bestEval = eval;
-            _bestMove = m;
+                c.pv.update(depth, m);
+                _multiPV.insert(m, eval, c.pv.chain(depth), k);
+                if (_multiPV.count() == k) bound = _multiPV.line(k-1).value;
+                if (eval > bestEval) {
+                    bestEval = eval;
+                    _bestMove = m;
+                    _bestValue = eval;
+                    _pv = c.pv;
+                }
             }
         }
     }
 
+    numberOfEval += finishThreads(threads);
+    if (_sc) _sc->stats(0).finishedNode(depth, nMoves);
+
+    // stopped before any move was searched completely
+    if ((_bestMove.type == Move::none) && (nMoves > 0))
+        _bestMove = moves[0];
+
+    if (_sc && _sc->verbose())
+        printf("Root: %d moves on %d threads, utilisation %d%%\n",
+               nMoves, threads, utilisation(cost, nMoves, threads));
+
     // printf("best Eval = %d\n", bestEval);
     return bestEval;
 }
 
-int MinimaxStrategy::minimaxSeq(char depth, Board* tempBoard, Evaluator* ev, int alpha, int beta, int& numberOfEval)
+int MinimaxStrategy::generateReplies(Board& tempBoard, Move* moves, int nMoves,
+                                     Move* replyMoves, int* replyCount)
 {
-    bool maximizeTurn = !(depth % 2); // even depth is maximizing, odd depth is minimizing
-
-    if (depth >= _adaptiveDepth) //if leaf node is reached, evaluate the board
-    {
-        int eval = (1-maximizeTurn*2)*ev->calcEvaluation(tempBoard);
-        //printf("nEval = %d, eval (leaf node)= %d, move = %s\n", _numberOfEval, eval, m.name());
-        numberOfEval++;
-        return eval;
+    int maxReplies = 0;
+    for(int i=0; i<nMoves; i++) {
+        MoveList list;
+        tempBoard.playMove(moves[i]);
+        tempBoard.generateMoves(list);
+        tempBoard.takeBack();
+        replyCount[i] = 0;
+        while(list.getNext(replyMoves[i * MoveList::MaxMoves + replyCount[i]]))
+            replyCount[i]++;
+        if (replyCount[i] > maxReplies) maxReplies = replyCount[i];
     }
+    return maxReplies;
+}
 
-    // we try to maximize bestEvaluation
-    int eval;
+int MinimaxStrategy::minimaxSplit(char depth, Board& tempBoard, Move* moves, int nMoves,
+                                  int& numberOfEval, int threads)
+{
+    // replies to each root move
+    Move* replyMoves = new Move[nMoves * MoveList::MaxMoves];
+    int* replyCount = new int[nMoves];
+    int maxReplies = generateReplies(tempBoard, moves, nMoves, replyMoves, replyCount);
+
+    // work list of (root move, reply) pairs: first replies of all root
+    // moves first, so that later replies can use their values as bound
+    Move* replies = new Move[nMoves * MoveList::MaxMoves];
+    int* root = new int[nMoves * MoveList::MaxMoves];
+    long long* cost = new long long[nMoves * MoveList::MaxMoves]();
+    int items = 0;
+    for(int j=0; j<maxReplies; j++)
+        for(int i=0; i<nMoves; i++) {
+            if (j >= replyCount[i]) continue;
+            replies[items] = replyMoves[i * MoveList::MaxMoves + j];
+            root[items++] = i;
+        }
+    delete[] replyMoves;
+
+    // per root move: minimum over replies (also used as beta for further
+    // replies), its principal variation, and number of replies searched
+    std::atomic<int>* rootValue = new std::atomic<int>[nMoves];
+    std::atomic<int>* done = new std::atomic<int>[nMoves];
+    Variation* rootPv = new Variation[nMoves];
+    for(int i=0; i<nMoves; i++) {
+        rootValue[i] = 35000;
+        done[i] = 0;
+    }
 
-    MoveList list;
-    Move m;
+    // value of the k-th best root move searched completely is the bound
+    // for further root moves (see minimaxPar): a root move with a reply
+    // not above this bound is not searched further
+    int lines = _multiPVLines;
+    std::atomic<int> bound(-35000);
 
-    // generate list of allowed moves, put them into <list>
-    tempBoard->generateMoves(list);
+    #pragma omp parallel num_threads(threads)
+    {
+        SearchContext& c = startThread(omp_get_thread_num(), tempBoard);
 
-    if(maximizeTurn){
-        int bestValue = -35000; //initialize with the worst value
-        // loop over all moves
-        while(list.getNext(m))
+        #pragma omp for schedule(dynamic,1)
+        for(int k=0; k<items; k++)
         {
-            // draw move, evaluate, and restore position
-            tempBoard->playMove(m);
-            eval = minimaxSeq(depth + 1, tempBoard, ev, alpha, beta, numberOfEval);
-            tempBoard->takeBack();
-            if(eval>bestValue){
-                bestValue = eval;
+            int i = root[k];
+            int eval;
+
+            if (_sc && _sc->stopRequested()) continue;
+            int alpha = bound.load(std::memory_order_relaxed);
+            if (rootValue[i].load(std::memory_order_relaxed) <= alpha) continue;
+
+            long long leaves = c.stats.leaves;
+            c.path.clear();
+            c.path.push(_rootKey);
+            c.pv.clear(_adaptiveDepth - 1);
+            unsigned long long key = c.board.playMoveKey(moves[i], _rootKey);
+            if (isRepetition(key, c.path))
+                eval = -_contempt;
+            else {
+                c.path.push(key);
+                key = c.board.playMoveKey(replies[k], key);
+                eval = searchChild<true>(depth + 2, alpha,
+                                   rootValue[i].load(std::memory_order_relaxed), key, c);
+                c.board.takeBack();
+            }
+            c.board.takeBack();
+
+            cost[k] = c.stats.leaves - leaves;
+            // result of an interrupted search is not reliable
+            if (_sc && _sc->stopRequested()) continue;
+
+            if (eval < rootValue[i].load(std::memory_order_relaxed))
+            {
+                #pragma omp critical (rootValue)
+                if (eval < rootValue[i].load(std::memory_order_relaxed)) {
+                    rootValue[i] = eval;
+                    c.pv.update(depth + 1, replies[k]);
+                    rootPv[i] = c.pv;
+                }
+            }
+            // root move not better than k-th best: never counts as searched completely
+            if (eval <= alpha) continue;
+
+            if (++done[i] == replyCount[i]) {
+                #pragma omp critical (rootValue)
+                {
+                    Variation line = rootPv[i];
+                    line.update(depth, moves[i]);
+                    _multiPV.insert(moves[i], rootValue[i], line.chain(depth), lines);
+                    if (_multiPV.count() == lines) bound = _multiPV.line(lines-1).value;
+                }
+            }
+        }
+    }
+    numberOfEval += finishThreads(threads);
+
+    // reduce over root moves searched completely, in move order
+    int bestEval = -35000;
+    for(int i=0; i<nMoves; i++) {
+        if (_sc) _sc->stats(0).finishedNode(depth + 1, replyCount[i]);
+        // without replies, the initial value would make it the best move
+        if ((replyCount[i] == 0) || (done[i] < replyCount[i])) continue;
+        if (rootValue[i] > bestEval) {
+            bestEval = rootValue[i];
+            _bestMove = moves[i];
+            _bestValue = bestEval;
+            rootPv[i].update(depth, moves[i]);
+            _pv = rootPv[i];
+        }
+    }
+    if (_sc) _sc->stats(0).finishedNode(depth, nMoves);
+
+    // stopped before any move was searched completely
+    if ((_bestMove.type == Move::none) && (nMoves > 0))
+        _bestMove = moves[0];
+
+    if (_sc && _sc->verbose())
+        printf("Root split: %d moves, %d (move, reply) pairs on %d threads, utilisation %d%%\n",
+               nMoves, items, threads, utilisation(cost, items, threads));
+
+    delete[] replies;
+    delete[] cost;
+    delete[] root;
+    delete[] replyCount;
+    delete[] rootValue;
+    delete[] done;
+    delete[] rootPv;
+    return bestEval;
+}
+
+/**
+ * Deterministic search of the root
+ *
+ * Result and node counts of a search must not depend on thread count or
+ * timing. So no bound found by one thread is used by another one while
+ * searching; instead, (root move, reply) pairs are searched in waves,
+ * where the window of a pair only depends on results of earlier waves.
+ * Root moves are searched in groups of fixed size (the first group: the
+ * k first moves, k: multi-PV lines), with the value of the k-th best move
+ * of the groups before as bound (alpha). In a group, the first replies
+ * are searched first, then further replies in waves of fixed size, with
+ * the minimum of the waves before as beta. Ties are broken by order: the
+ * earlier reply of a root move, and the earlier root move.
+ */
+int MinimaxStrategy::minimaxOrdered(char depth, Board& tempBoard, Move* moves, int nMoves,
+                                    int& numberOfEval, int threads)
+{
+    int lines = _multiPVLines;
+    int bestEval = -35000;
+    RootResult* result = new RootResult[nMoves];
+    for(int i=0; i<nMoves; i++) {
+        result[i].value = 35000;
+        result[i].reply = MoveList::MaxMoves;
+        result[i].done = 0;
+        result[i].alpha = -35000;
+        result[i].beta = 35000;
+    }
+
+    if (_adaptiveDepth <= depth + 1) {
+        // root moves lead to leaves: no replies to split into
+        SearchContext& c = startThread(0, tempBoard);
+        for(int i=0; i<nMoves; i++) {
+            c.path.clear();
+            c.path.push(_rootKey);
+            c.pv.clear(_adaptiveDepth - 1);
+            unsigned long long key = c.board.playMoveKey(moves[i], _rootKey);
+            result[i].value = searchChild<false>(depth + 1, -35000, 35000, key, c);
+            c.board.takeBack();
+            result[i].pv = c.pv;
+        }
+        numberOfEval += finishThreads(1);
+
+        for(int i=0; i<nMoves; i++) {
+            result[i].pv.update(depth, moves[i]);
+            _multiPV.insert(moves[i], result[i].value, result[i].pv.chain(depth), lines);
+            if (result[i].value > bestEval) {
+                bestEval = result[i].value;
+                _bestMove = moves[i];
+                _bestValue = bestEval;
+                _pv = result[i].pv;
             }
-            if(bestValue>=beta){
-                break;
+        }
+        if (_sc) _sc->stats(0).finishedNode(depth, nMoves);
+        delete[] result;
+        return bestEval;
+    }
+
+    Move* replyMoves = new Move[nMoves * MoveList::MaxMoves];
+    int* replyCount = new int[nMoves];
+    Pair* pairs = new Pair[((lines > rootGroup) ? lines : rootGroup) * MoveList::MaxMoves];
+    int maxReplies = generateReplies(tempBoard, moves, nMoves, replyMoves, replyCount);
+
+    int groups = 0;
+    for(int from = 0; from < nMoves; groups++) {
+        int to = from + ((from == 0) ? lines : rootGroup);
+        if (to > nMoves) to = nMoves;
+
+        // value of the k-th best root move of the groups before is the bound
+        int bound = (_multiPV.count() == lines) ? _multiPV.line(lines-1).value : -35000;
+        for(int i=from; i<to; i++)
+            result[i].alpha = bound;
+        searchRoots(depth, tempBoard, moves, replyMoves, replyCount, maxReplies,
+                    from, to, result, pairs, numberOfEval, threads);
+
+        // reduce over root moves searched completely, in move order
+        for(int i=from; i<to; i++) {
+            RootResult& r = result[i];
+            if (_sc) _sc->stats(0).finishedNode(depth + 1, replyCount[i]);
+            // not better than bound: value only is an upper bound
+            if ((replyCount[i] == 0) || (r.done < replyCount[i]) || (r.value <= r.alpha)) continue;
+
+            r.pv.update(depth, moves[i]);
+            _multiPV.insert(moves[i], r.value, r.pv.chain(depth), lines);
+            if (r.value > bestEval) {
+                bestEval = r.value;
+                _bestMove = moves[i];
+                _bestValue = bestEval;
+                _pv = r.pv;
             }
-            if(alpha<eval){
-                alpha = eval;
+        }
+        from = to;
+    }
+    if (_sc) _sc->stats(0).finishedNode(depth, nMoves);
+
+    // stopped before any move was searched completely
+    if ((_bestMove.type == Move::none) && (nMoves > 0))
+        _bestMove = moves[0];
+
+    if (_sc && _sc->verbose())
+        printf("Root deterministic: %d moves in %d groups on %d threads\n",
+               nMoves, groups, threads);
+
+    delete[] replyMoves;
+    delete[] replyCount;
+    delete[] pairs;
+    delete[] result;
+    return bestEval;
+}
+
+void MinimaxStrategy::searchRoots(char depth, Board& tempBoard, Move* moves, Move* replyMoves,
+                                  int* replyCount, int maxReplies, int from, int to,
+                                  RootResult* result, Pair* pairs, int& numberOfEval, int threads)
+{
+    int count = 0;
+    for(int i=from; i<to; i++) {
+        if (replyCount[i] == 0) continue;
+        pairs[count].root = i;
+        pairs[count++].reply = 0;
+    }
+    searchPairs(depth, tempBoard, moves, replyMoves, pairs, count, result, numberOfEval, threads);
+
+    // further replies only of root moves not below alpha yet
+    for(int first=1; first<maxReplies; first+=replyWave) {
+        count = 0;
+        for(int i=from; i<to; i++) {
+            RootResult& r = result[i];
+            r.beta = r.value;
+            if (r.value <= r.alpha) continue;
+            for(int j=first; (j<first+replyWave) && (j<replyCount[i]); j++) {
+                pairs[count].root = i;
+                pairs[count++].reply = j;
             }
         }
-        return bestValue;
+        searchPairs(depth, tempBoard, moves, replyMoves, pairs, count, result, numberOfEval, threads);
     }
-    else{
-        int worstValue = 35000; //initialize with the best value
-        // loop over all moves
-        while(list.getNext(m))
+}
+
+void MinimaxStrategy::searchPairs(char depth, Board& tempBoard, Move* moves, Move* replyMoves,
+                                  Pair* pairs, int count, RootResult* result,
+                                  int& numberOfEval, int threads)
+{
+    if (count == 0) return;
+
+    #pragma omp parallel num_threads(threads)
+    {
+        SearchContext& c = startThread(omp_get_thread_num(), tempBoard);
+
+        #pragma omp for schedule(dynamic,1)
+        for(int k=0; k<count; k++)
         {
-            // draw move, evaluate, and restore position
-            tempBoard->playMove(m);
-            eval = minimaxSeq(depth + 1, tempBoard, ev, alpha, beta, numberOfEval);
-            tempBoard->takeBack();
-            if(eval<worstValue){
-                worstValue = eval;
+            int i = pairs[k].root, j = pairs[k].reply;
+            RootResult& r = result[i];
+            Move& reply = replyMoves[i * MoveList::MaxMoves + j];
+            int eval;
+
+            if (_sc && _sc->stopRequested()) continue;
+
+            c.path.clear();
+            c.path.push(_rootKey);
+            c.pv.clear(_adaptiveDepth - 1);
+            unsigned long long key = c.board.playMoveKey(moves[i], _rootKey);
+            if (isRepetition(key, c.path))
+                eval = -_contempt;
+            else {
+                c.path.push(key);
+                key = c.board.playMoveKey(reply, key);
+                eval = searchChild<true>(depth + 2, r.alpha, r.beta, key, c);
+                c.board.takeBack();
             }
-            if(worstValue<=alpha){
-                break;
+            c.board.takeBack();
+
+            // result of an interrupted search is not reliable
+            if (_sc && _sc->stopRequested()) continue;
+
+            // minimum independent of the order replies finish in
+            #pragma omp critical (rootValue)
+            {
+                r.done++;
+                if ((eval < r.value) || ((eval == r.value) && (j < r.reply))) {
+                    r.value = eval;
+                    r.reply = j;
+                    c.pv.update(depth + 1, reply);
+                    r.pv = c.pv;
+                }
             }
-            if(beta>eval){
-                beta = eval;
+        }
+    }
+    numberOfEval += finishThreads(threads);
+}
+
+void MinimaxStrategy::storeResult(unsigned long long key, int symmetry, int remaining,
+                                  int value, int alpha, int beta, Move* best)
+{
+    if (!_tt || (_sc && _sc->stopRequested())) return;
+
+    int bound = (value >= beta) ? TranspositionTable::lower :
+                (value <= alpha) ? TranspositionTable::upper : TranspositionTable::exact;
+    _tt->store(key, symmetry, remaining, value, bound, *best);
+}
+
+bool MinimaxStrategy::stopAfterLeaf(SearchStats& stats)
+{
+    stats.leaves++;
+    if (!_sc) return false;
+    if ((stats.leaves % SearchCallbacks::pollInterval) == 0)
+        return _sc->timeIsUp();
+    return false;
+}
+
+template<bool maximize>
+int MinimaxStrategy::searchChild(char depth, int alpha, int beta, unsigned long long key,
+                                 SearchContext& c)
+{
+    // repeated position: draw, valued -contempt for us, no need to search further
+    if (isRepetition(key, c.path)) {
+        c.pv.clearRow(depth);
+        return -_contempt;
+    }
+
+    c.path.push(key);
+    int eval = c.trace ? minimaxSeq<maximize, true>(depth, alpha, beta, c)
+                       : minimaxSeq<maximize, false>(depth, alpha, beta, c);
+    c.path.pop();
+    return eval;
+}
+
+template<bool maximize>
+int MinimaxStrategy::leafValue(SearchContext& c)
+{
+    // evaluation is from view of the side which moved last
+    int eval = _ev->calcEvaluation(&c.board);
+    //printf("nEval = %d, eval (leaf node)= %d, move = %s\n", _numberOfEval, eval, m.name());
+    stopAfterLeaf(c.stats);
+    return maximize ? -eval : eval;
+}
+
+template<bool maximize>
+int MinimaxStrategy::leafValues(char depth, MoveList& list, bool& ttFirst, Move& ttMove,
+                                SearchContext& c, Move* moves, int* values)
+{
+    EvalBatch& batch = c.leaves;
+    int lane[EvalBatch::lanes];
+    int n = 0;
+    Move m;
+
+    batch.start(&c.board);
+    while(n < EvalBatch::lanes)
+    {
+        if (ttFirst) { m = ttMove; ttFirst = false; }
+        else if (!list.getNext(m)) break;
+
+        // repeated position: draw, as in searchChild; the key of this
+        // node is on top of the path
+        if (isRepetition(c.board.playMoveKey(m, c.path.top()), c.path)) {
+            c.pv.clearRow(depth);
+            values[n] = -_contempt;
+            lane[n] = -1;
+        }
+        else {
+            lane[n] = batch.count();
+            batch.add(&c.board, m);
+        }
+        c.board.takeBack();
+        moves[n++] = m;
+    }
+    if (batch.count() == 0) return n;
+
+    // evaluation is from view of the side which moved last
+    int eval[EvalBatch::lanes];
+    _ev->calcEvaluations(batch, eval);
+    for(int i=0; i<n; i++) {
+        if (lane[i] < 0) continue;
+        values[i] = maximize ? -eval[lane[i]] : eval[lane[i]];
+        stopAfterLeaf(c.stats);
+    }
+    return n;
+}
+
+template<bool maximize, bool traced>
+int MinimaxStrategy::minimaxSeq(char depth, int alpha, int beta, SearchContext& c)
+{
+    Board* tempBoard = &c.board;
+    SearchStats& stats = c.stats;
+    Variation& pv = c.pv;
+
+    if (depth >= _adaptiveDepth) //if leaf node is reached, evaluate the board
+        return leafValue<maximize>(c);
+
+    int eval;
+
+    MoveList list;
+    Move m, ttMove;
+    int played = 0;
+
+    // generate list of allowed moves, put them into <list>
+    tempBoard->generateMoves(list);
+
+    // cached result? The table stores values from view of side to move
+    int remaining = _adaptiveDepth - depth;
+    int sideAlpha = maximize ? alpha : -beta;
+    int sideBeta = maximize ? beta : -alpha;
+    unsigned long long key = 0;
+    int symmetry = 0;
+    if (_tt) {
+        // searchChild pushed the key of this position
+        key = _tt->key(tempBoard, c.path.top(), symmetry);
+        if (_tt->probe(key, symmetry, remaining, sideAlpha, sideBeta, eval, ttMove)) {
+            stats.ttHits++;
+            pv.clearRow(depth);
+            return maximize ? eval : -eval;
+        }
+    }
+    // try the cached best move first
+    bool ttFirst = (ttMove.type != Move::none) && list.isElement(ttMove, 0, true);
+
+    // leaves at start of the node and of the child searched last, if traced
+    bool sampled = traced && c.trace->sample();
+    long long nodeLeaves = stats.leaves, childLeaves = nodeLeaves;
+    int cutoff = 0;
+
+    // children at the last ply are evaluated in batches, except the first
+    // one: often, it already gives a cutoff
+    bool batched = (depth + 1 >= _adaptiveDepth) && _ev->canEvaluateBatch();
+    Move batchMove[EvalBatch::lanes];
+    int batchValue[EvalBatch::lanes];
+    int batchCount = 0, batchNext = 0;
+
+    // maximizing: we try to maximize bestValue, and raise alpha;
+    // minimizing: opponent tries to minimize it, and lowers beta
+    int bestValue = maximize ? -35000 : 35000; //initialize with the worst value
+    // loop over all moves
+    while(true)
+    {
+        if (traced) childLeaves = stats.leaves;
+        if (batched && (played > 0)) {
+            if (batchNext == batchCount) {
+                batchCount = leafValues<!maximize>(depth + 1, list, ttFirst, ttMove,
+                                                   c, batchMove, batchValue);
+                batchNext = 0;
+                if (batchCount == 0) break;
             }
+            m = batchMove[batchNext];
+            eval = batchValue[batchNext++];
+            // a batch is evaluated at once: count one leaf per child before
+            if (traced) childLeaves = nodeLeaves + played;
         }
-        return worstValue;
+        else {
+            if (ttFirst) { m = ttMove; ttFirst = false; }
+            else if (!list.getNext(m)) break;
+            // draw move, evaluate, and restore position
+            unsigned long long childKey = tempBoard->playMoveKey(m, c.path.top());
+            eval = searchChild<!maximize>(depth + 1, alpha, beta, childKey, c);
+            tempBoard->takeBack();
+        }
+        played++;
+        if(maximize ? (eval>bestValue) : (eval<bestValue)){
+            bestValue = eval;
+            pv.update(depth, m);
+        }
+        if(maximize ? (bestValue>=beta) : (bestValue<=alpha)){
+            stats.cutoffs++;
+            if (traced) cutoff = played;
+            break;
+        }
+        if(maximize && (alpha<eval)) alpha = eval;
+        if(!maximize && (beta>eval)) beta = eval;
+        if(_sc && _sc->stopRequested()) break;
+    }
+    stats.finishedNode(depth, played);
+    if (sampled) {
+        TraceEvent& e = c.trace->add();
+        e.alpha = sideAlpha;
+        e.beta = sideBeta;
+        e.value = maximize ? bestValue : -bestValue;
+        e.leaves = (unsigned int) (stats.leaves - nodeLeaves);
+        e.wasted = (cutoff > 1) ? (unsigned int) (childLeaves - nodeLeaves) : 0;
+        e.depth = depth;
+        e.thread = c.trace->thread();
+        e.moves = list.getLength();
+        e.played = played;
+        e.cutoff = cutoff;
     }
+    storeResult(key, symmetry, remaining, maximize ? bestValue : -bestValue,
+                sideAlpha, sideBeta, pv.chain(depth));
+    return bestValue;
 }
 
 
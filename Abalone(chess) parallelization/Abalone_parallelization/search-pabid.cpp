@@ -0,0 +1,437 @@
+/**
+ * Parallel Alpha/Beta with Iterative Deepening
+ *
+ * Same search as ABID (principal variation first, depth dependent
+ * selectivity by move type, aspiration windows), parallelized by
+ * principal variation splitting: at a node of the principal variation,
+ * the first (PV) move is searched recursively to get a good bound.
+ * Then, all other moves of this node are distributed over threads.
+ * Each thread searches on its own copy of the board, with the alpha
+ * value shared between threads. A beta cutoff found by one thread
+ * aborts the other searches of the node.
+ */
+
+#include <stdio.h>
+#include <atomic>
+#include <omp.h>
+
+#include "search.h"
+#include "board.h"
+#include "eval.h"
+#include "tt.h"
+
+class PABIDStrategy: public SearchStrategy
+{
+ public:
+    PABIDStrategy(): SearchStrategy("ParallelABID", 8) {}
+    SearchStrategy* clone() { return new PABIDStrategy(); }
+
+    Move& nextMove() { return _pv[1]; }
+    Move* pv() { return _pv.chain(0); }
+
+ private:
+    /* search state of one thread */
+    struct Context {
+	Board board;
+	Variation* pv;
+	KeyStack path;  // positions on search path
+	int thread;
+	bool inPV;
+	std::atomic<bool>* abort; // set if result is not needed any more
+    };
+
+    void searchBestMove();
+    /* search along principal variation, splitting below PV nodes */
+    int pvSplit(int depth, int alpha, int beta, Context& c);
+    /* recursive alpha/beta search of one thread */
+    int alphabeta(int depth, int alpha, int beta, Context& c);
+    int evaluate(Context& c);
+    bool stopped(Context& c)
+	{ return _abortSearch || (c.abort && *c.abort); }
+    /* depth search for these move types at <depth> */
+    int maxTypeAt(int depth)
+	{ return (depth < _currentMaxDepth-1) ? Move::maxMoveType :
+	         (depth < _currentMaxDepth)   ? Move::maxPushType :
+	                                        Move::maxOutType; }
+
+    /* prinicipal variation found in last search */
+    Variation _pv;
+    Move _currentBestMove;
+    int _currentMaxDepth;
+    std::atomic<bool> _abortSearch;
+};
+
+
+/**
+ * Entry point for search
+ *
+ * Does iterative deepening and alpha/beta width handling as ABID
+ */
+void PABIDStrategy::searchBestMove()
+{
+    int alpha = -15000, beta = 15000;
+    int nalpha, nbeta, currentValue = 0;
+    bool stop = false;
+
+    Context c;
+    c.board = *_board;
+    c.pv = &_pv;
+    c.thread = 0;
+    c.abort = 0;
+    c.path.push(_board->hashKey());
+
+    _pv.clear(_maxDepth);
+    _currentBestMove.type = Move::none;
+    _currentMaxDepth=1;
+    _abortSearch = false;
+
+    /* iterative deepening loop */
+    do {
+
+	/* searches on same level with different alpha/beta windows */
+	while(1) {
+
+	    nalpha = alpha, nbeta = beta;
+	    c.inPV = (_pv[0].type != Move::none);
+
+	    if (_sc && _sc->verbose()) {
+		char tmp[100];
+		sprintf(tmp, "Alpha/Beta [%d;%d] with max depth %d (%d threads)",
+			alpha, beta, _currentMaxDepth,
+			(_threads > 0) ? _threads : omp_get_max_threads());
+		_sc->substart(tmp);
+	    }
+
+	    currentValue = pvSplit(0, alpha, beta, c);
+
+	    /* stop searching if a win position is found */
+	    stop = _abortSearch || _stopSearch ||
+		(currentValue > 14900) || (currentValue < -14900);
+
+	    /* Don't break out if we haven't found a move */
+	    if (_currentBestMove.type == Move::none)
+		stop = false;
+
+	    if (stop) break;
+
+	    /* if result is outside of current alpha/beta window,
+	     * the search has to be rerun with widened alpha/beta
+	     */
+	    if (currentValue <= nalpha) {
+		alpha = -15000;
+		if (beta<15000) beta = currentValue+1;
+		continue;
+	    }
+	    if (currentValue >= nbeta) {
+		if (alpha > -15000) alpha = currentValue-1;
+		beta=15000;
+		continue;
+	    }
+	    break;
+	}
+
+	/* Window in both directions cause of deepening */
+	alpha = currentValue - 200, beta = currentValue + 200;
+
+	if (stop) break;
+
+	_currentMaxDepth++;
+    }
+    while(_currentMaxDepth <= _maxDepth);
+
+    _bestMove = _currentBestMove;
+}
+
+int PABIDStrategy::evaluate(Context& c)
+{
+    int v = _ev->calcEvaluation(&c.board);
+    if (_sc && _sc->afterEval(c.thread)) _abortSearch = true;
+    return v;
+}
+
+
+/*
+ * Principal variation splitting
+ *
+ * Only called by the main thread. Below the last PV node, or if the
+ * PV move is not legal (any more), this is a sequential search.
+ */
+int PABIDStrategy::pvSplit(int depth, int alpha, int beta, Context& c)
+{
+    if (!c.inPV || (depth >= _currentMaxDepth-1))
+	return alphabeta(depth, alpha, beta, c);
+
+    int currentValue, value;
+    MoveList list;
+    Move m, moves[MoveList::MaxMoves];
+    bool deep[MoveList::MaxMoves];
+    int count = 0;
+    int maxType = maxTypeAt(depth);
+
+    c.board.generateMoves(list);
+    m = (*c.pv)[depth];
+    if ((m.type == Move::none) || !list.isElement(m, 0, true)) {
+	c.inPV = false;
+	return alphabeta(depth, alpha, beta, c);
+    }
+
+    if (_sc && _sc->verbose()) {
+	    char tmp[100];
+	    sprintf(tmp, "PV split [%d;%d], %d moves (%d depth)", alpha, beta,
+		    list.count(Move::none), list.count(maxType));
+	    _sc->startedNode(depth, tmp);
+    }
+
+    /* PV move first, sequentially */
+    c.board.playMove(m);
+    unsigned long long key = c.board.hashKey();
+    if (!c.board.isValid())
+	value = 14999-depth;
+    else if (isRepetition(key, c.path))
+	value = drawValue(depth);
+    else if (m.type <= maxType) {
+	c.path.push(key);
+	value = -pvSplit(depth+1, -beta, -alpha, c);
+	c.path.pop();
+    }
+    else
+	value = evaluate(c);
+    c.board.takeBack();
+
+    currentValue = value;
+    _pv.update(depth, m);
+    if (_sc) _sc->foundBestMove(depth, m, currentValue);
+    if (depth == 0) {
+	_currentBestMove = m;
+	_bestValue = currentValue;
+    }
+    if (currentValue>14900 || currentValue >= beta || stopped(c)) {
+	if (_sc) {
+	    if (currentValue >= beta) _sc->stats().cutoffs++;
+	    _sc->finishedNode(depth, _pv.chain(depth), 1);
+	}
+	return currentValue;
+    }
+    if (currentValue > alpha) alpha = currentValue;
+
+    /* remaining moves in the order ABID would play them */
+    while(list.getNext(m, maxType)) {
+	moves[count] = m;
+	deep[count++] = true;
+    }
+    while(list.getNext(m, Move::none)) {
+	moves[count] = m;
+	deep[count++] = false;
+    }
+
+    std::atomic<int> sharedAlpha(alpha);
+    std::atomic<bool> cutoff(false);
+
+    int threads = (_threads > 0) ? _threads : omp_get_max_threads();
+    if (threads > SearchCallbacks::maxThreads) threads = SearchCallbacks::maxThreads;
+    #pragma omp parallel for schedule(dynamic,1) num_threads(threads)
+    for(int i=0; i<count; i++) {
+	if (cutoff || _abortSearch) continue;
+
+	Variation pv;
+	pv.clear(_maxDepth);
+	Context w;
+	w.board = c.board;
+	w.pv = &pv;
+	w.path = c.path;
+	w.thread = omp_get_thread_num();
+	w.inPV = false;
+	w.abort = &cutoff;
+
+	int a = sharedAlpha;
+	int v;
+	w.board.playMove(moves[i]);
+	unsigned long long key = w.board.hashKey();
+	if (!w.board.isValid())
+	    v = 14999-depth;
+	else if (isRepetition(key, w.path))
+	    v = drawValue(depth);
+	else if (deep[i]) {
+	    w.path.push(key);
+	    v = -alphabeta(depth+1, -beta, -a, w);
+	}
+	else
+	    v = evaluate(w);
+
+	/* result of an aborted search is not exact */
+	if (stopped(w)) continue;
+
+	#pragma omp critical (pabidBest)
+	if (v > currentValue) {
+	    currentValue = v;
+	    _pv.copyRow(depth+1, pv);
+	    _pv.update(depth, moves[i]);
+
+	    if (_sc) _sc->foundBestMove(depth, moves[i], currentValue);
+	    if (depth == 0) {
+		_currentBestMove = moves[i];
+		_bestValue = currentValue;
+	    }
+
+	    if (currentValue>14900 || currentValue >= beta) {
+		if (_sc && (currentValue >= beta)) _sc->stats(w.thread).cutoffs++;
+		cutoff = true;
+	    }
+	    else if (currentValue > sharedAlpha)
+		sharedAlpha = currentValue;
+	}
+    }
+
+    if (_sc) _sc->finishedNode(depth, _pv.chain(depth), count+1);
+
+    return currentValue;
+}
+
+
+/*
+ * Alpha/Beta search, as in ABID
+ *
+ * - first, start with principal variation, then with move from
+ *   transposition table
+ * - depending on depth, we only do depth search for some move types
+ */
+int PABIDStrategy::alphabeta(int depth, int alpha, int beta, Context& c)
+{
+    int currentValue = -14999+depth, value;
+    Move m;
+    MoveList list;
+    bool depthPhase, doDepthSearch;
+    int played = 0;
+    int alpha0 = alpha, remaining = _currentMaxDepth - depth;
+    unsigned long long key = 0, childKey;
+    int symmetry = 0;
+    Move ttMove;
+    Variation& pv = *c.pv;
+
+    int maxType = maxTypeAt(depth);
+
+    c.board.generateMoves(list);
+
+    /* cached result; not while following the principal variation */
+    if (_tt && (remaining > 0)) {
+	key = _tt->key(&c.board, symmetry);
+	if (_tt->probe(key, symmetry, remaining, alpha, beta, value, ttMove) &&
+	    !c.inPV && (depth > 0)) {
+	    if (_sc) _sc->stats(c.thread).ttHits++;
+	    pv.clearRow(depth);
+	    return value;
+	}
+    }
+
+    if (_sc && _sc->verbose()) {
+	    char tmp[100];
+	    sprintf(tmp, "Alpha/Beta [%d;%d], %d moves (%d depth)", alpha, beta,
+		    list.count(Move::none), list.count(maxType));
+	    _sc->startedNode(depth, tmp, c.thread);
+    }
+
+    /* check for an old best move in principal variation */
+    if (c.inPV) {
+	m = pv[depth];
+
+	if ((m.type != Move::none) &&
+	    (!list.isElement(m, 0, true)))
+	    m.type = Move::none;
+
+	if (m.type == Move::none) c.inPV = false;
+    }
+    if ((m.type == Move::none) && (ttMove.type != Move::none) &&
+	list.isElement(ttMove, 0, true))
+	m = ttMove;
+
+    // first, play all moves with depth search
+    depthPhase = true;
+
+    while (1) {
+
+	// get next move
+	if (m.type == Move::none) {
+            if (depthPhase)
+		depthPhase = list.getNext(m, maxType);
+            if (!depthPhase)
+		if (!list.getNext(m, Move::none)) break;
+	}
+	// we could start with a non-depth move from principal variation
+	doDepthSearch = depthPhase && (m.type <= maxType);
+
+	c.board.playMove(m);
+	played++;
+	childKey = c.board.hashKey();
+
+	/* check for a win position first */
+	if (!c.board.isValid()) {
+
+	    /* Shorter path to win position is better */
+	    value = 14999-depth;
+	}
+	else if (isRepetition(childKey, c.path)) {
+
+	    /* cycle: draw, no need to search further */
+	    value = drawValue(depth);
+	}
+	else {
+
+            if (doDepthSearch) {
+		/* opponent searches for its maximum; but we want the
+		 * minimum: so change sign (for alpha/beta window too!)
+		 */
+		c.path.push(childKey);
+		value = -alphabeta(depth+1, -beta, -alpha, c);
+		c.path.pop();
+            }
+            else {
+		value = evaluate(c);
+	    }
+	}
+
+	c.board.takeBack();
+
+	/* best move so far? */
+	if (value > currentValue) {
+	    currentValue = value;
+	    pv.update(depth, m);
+
+	    if (_sc && (c.thread == 0)) _sc->foundBestMove(depth, m, currentValue);
+	    if (depth == 0) {
+		_currentBestMove = m;
+		_bestValue = currentValue;
+	    }
+
+	    /* alpha/beta cut off or win position ... */
+	    if (currentValue>14900 || currentValue >= beta) {
+		if (_tt && (remaining > 0) && !stopped(c) && (currentValue <= 14900))
+		    _tt->store(key, symmetry, remaining, currentValue, TranspositionTable::lower, m);
+		if (_sc) {
+		    if (currentValue >= beta) _sc->stats(c.thread).cutoffs++;
+		    _sc->finishedNode(depth, pv.chain(depth), played, c.thread);
+		}
+		return currentValue;
+	    }
+
+	    /* maximize alpha */
+	    if (currentValue > alpha) alpha = currentValue;
+	}
+
+	if (stopped(c)) break;
+	m.type = Move::none;
+    }
+
+    /* win positions depend on depth: do not cache */
+    if (_tt && (remaining > 0) && !stopped(c) &&
+	(currentValue > -14900) && (currentValue < 14900))
+	_tt->store(key, symmetry, remaining, currentValue,
+		   (currentValue > alpha0) ? TranspositionTable::exact : TranspositionTable::upper,
+		   *pv.chain(depth));
+
+    if (_sc) _sc->finishedNode(depth, pv.chain(depth), played, c.thread);
+
+    return currentValue;
+}
+
+// register ourselve
+PABIDStrategy pabidStrategy;
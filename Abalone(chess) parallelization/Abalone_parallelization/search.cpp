@@ -7,29 +7,92 @@
 
 #include <stdio.h>
 #include <string.h>
-#include <sys/time.h>
+#include <time.h>
 #include <stdlib.h>
 
 #include "board.h"
 #include "search.h"
 #include "eval.h"
+#include "book.h"
+#include "tt.h"
+#include "solver.h"
+#include "trace.h"
 
 
 
+/// SearchStats
+
+void SearchStats::clear()
+{
+    nodes = leaves = cutoffs = ttHits = 0;
+    for(int d=0;d<maxDepth;d++) {
+	depthNodes[d] = depthChildren[d] = 0;
+	leaveStart[d] = nodeStart[d] = 0;
+    }
+}
+
+void SearchStats::add(const SearchStats& s)
+{
+    nodes   += s.nodes;
+    leaves  += s.leaves;
+    cutoffs += s.cutoffs;
+    ttHits  += s.ttHits;
+    for(int d=0;d<maxDepth;d++) {
+	depthNodes[d]    += s.depthNodes[d];
+	depthChildren[d] += s.depthChildren[d];
+    }
+}
+
+double SearchStats::branchingFactor(int d) const
+{
+    if (d<0 || d>=maxDepth || depthNodes[d]==0) return 0.0;
+    return (double) depthChildren[d] / depthNodes[d];
+}
+
+
+/// MultiPV
+
+void MultiPV::insert(const Move& m, int value, const Move* pv, int k)
+{
+    if (k > maxLines) k = maxLines;
+    int i = _count;
+    while((i > 0) && (_line[i-1].value < value)) i--;
+    if (i >= k) return;
+
+    if (_count < k) _count++;
+    for(int j=_count-1; j>i; j--)
+	_line[j] = _line[j-1];
+
+    Line& l = _line[i];
+    l.move = m;
+    l.value = value;
+    int d = 0;
+    for(; pv && d<Variation::maxDepth && pv[d].type != Move::none; d++)
+	l.pv[d] = pv[d];
+    if (d < Variation::maxDepth) l.pv[d].type = Move::none;
+}
+
+
 /// SearchCallbacks
 
-static struct timeval t1, t2;
-static int kevalsPerSec = 30;
-static int evalCounter = 0;
+static long long usecsNow()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return 1000000LL * ts.tv_sec + ts.tv_nsec / 1000;
+}
 
 void SearchCallbacks::start(int msecsForSearch)
 {
-    _leavesVisited = 0;
-    _nodesVisited = 0;
-    gettimeofday(&t1,0);
-
-    evalCounter = 0;
+    for(int t=0;t<maxThreads;t++)
+	_stats[t].clear();
+    _total.clear();
+    _stop = false;
+    _msecsPassed = 0;
     _msecsForSearch = msecsForSearch;
+    _usecsStart = usecsNow();
+    _usecsReported = 0;
+    if (_tracer) _tracer->start();
 
     if (!_verbose) return;
 
@@ -49,64 +112,86 @@ void SearchCallbacks::substart(char* s)
 
 void SearchCallbacks::finished(Move& m)
 {
-    gettimeofday(&t2,0);
-    _msecsPassed =
-	(1000* t2.tv_sec + t2.tv_usec / 1000) -
-	(1000* t1.tv_sec + t1.tv_usec / 1000);
+    _msecsPassed = (int) ((usecsNow() - _usecsStart) / 1000);
+
+    _total.clear();
+    for(int t=0;t<maxThreads;t++)
+	_total.add(_stats[t]);
+
+    if (_json) printJSON(_json, m);
+    if (_tracer) _tracer->write();
 
     if (!_verbose) return;
 
-    if (_msecsPassed <1) _msecsPassed = 1;
-    if (_nodesVisited<1) _nodesVisited = 1;
+    int msecs = (_msecsPassed <1) ? 1 : _msecsPassed;
+    long long nodes = (_total.nodes <1) ? 1 : _total.nodes;
 
     printf(" Search finished after %d.%03d secs\n",
 	   _msecsPassed / 1000, _msecsPassed % 1000);
     printf("  Found move '%s'\n", m.name());
-    printf("  Leaves visited: %d (%d k/s) \n",
-	   _leavesVisited, _leavesVisited /_msecsPassed);
-    printf("  Nodes visited: %d (%d leaves per node)\n",
-	   _nodesVisited, _leavesVisited/_nodesVisited );
-    
-    int eps = _leavesVisited /_msecsPassed;
-    if (eps>kevalsPerSec) kevalsPerSec = eps;
+    printf("  Leaves visited: %lld (%lld k/s) \n",
+	   _total.leaves, _total.leaves / msecs);
+    printf("  Nodes visited: %lld (%lld leaves per node)\n",
+	   _total.nodes, _total.leaves / nodes);
+    if (_total.cutoffs || _total.ttHits)
+	printf("  Cutoffs: %lld, TT hits: %lld\n",
+	       _total.cutoffs, _total.ttHits);
 }
 
-bool SearchCallbacks::afterEval()
+void SearchCallbacks::printJSON(FILE* f, const Move& m)
 {
-    _leavesVisited++;
+    int threads = 0;
+    for(int t=0;t<maxThreads;t++)
+	if (_stats[t].leaves || _stats[t].nodes) threads++;
+
+    fprintf(f, "{\"move\":\"%s\",\"msecs\":%d,\"threads\":%d,"
+	    "\"nodes\":%lld,\"leaves\":%lld,\"cutoffs\":%lld,\"ttHits\":%lld,"
+	    "\"branching\":[",
+	    m.name(), _msecsPassed, threads,
+	    _total.nodes, _total.leaves, _total.cutoffs, _total.ttHits);
+    int depths = 0;
+    while(depths < SearchStats::maxDepth && _total.depthNodes[depths]>0)
+	depths++;
+    for(int d=0;d<depths;d++)
+	fprintf(f, "%s%.2f", (d==0) ? "":",", _total.branchingFactor(d));
+    fprintf(f, "]}\n");
+    fflush(f);
+}
 
-    int ms = _msecsForSearch / 3;
-    if (ms > 500) ms = 500;
-    if (ms < 200) ms = 200;
+bool SearchCallbacks::timeIsUp()
+{
+    if (_stop) return true;
+    if (_msecsForSearch <= 0) return false;
+
+    if (usecsNow() - _usecsStart > 1000LL * _msecsForSearch) {
+	_stop = true;
+	if (_verbose) printf(" Stop!\n");
+    }
+    return _stop;
+}
 
-    evalCounter++;
+bool SearchCallbacks::afterEval(int thread)
+{
+    SearchStats& s = stats(thread);
+    s.leaves++;
 
-    if (evalCounter < ms * kevalsPerSec) return false;
+    if ((s.leaves % pollInterval) != 0) return _stop;
     
     // FIXME: Check for network events
 
-    evalCounter = 0;
-
-    gettimeofday(&t2,0);
-    _msecsPassed =
-	(1000* t2.tv_sec + t2.tv_usec / 1000) -
-	(1000* t1.tv_sec + t1.tv_usec / 1000);
-
-    if (_msecsPassed <1) _msecsPassed = 1;
-    if (_nodesVisited<1) _nodesVisited = 1;
-
-    int eps = _leavesVisited / _msecsPassed;
-    if (_verbose)
-	printf(" EvalRate %d k/s (%d evals, %d msecs)\n",
-	       eps, _leavesVisited, _msecsPassed);
-    if (eps>kevalsPerSec) kevalsPerSec = eps;
-
-    if ((_msecsForSearch > 0) && (_msecsPassed > _msecsForSearch)) {
-	printf(" Stop!\n");
-	return true;
+    if (_verbose && (thread == 0)) {
+	// report eval rate of main thread every 500 msecs
+	long long usecs = usecsNow() - _usecsStart;
+	if (usecs - _usecsReported > 500000) {
+	    int msecs = (int) (usecs / 1000);
+	    if (msecs<1) msecs = 1;
+	    printf(" EvalRate %lld k/s (%lld evals, %d msecs)\n",
+		   s.leaves / msecs, s.leaves, msecs);
+	    _usecsReported = usecs;
+	}
     }
 
-    return false;
+    return timeIsUp();
 }
 
 void SearchCallbacks::foundBestMove(int d, const Move& m, int value)
@@ -118,24 +203,24 @@ void SearchCallbacks::foundBestMove(int d, const Move& m, int value)
 	   spaces+20-d, m.name(), value);
 }
 
-int _leaveStart[10], _nodeStart[10];
-
-void SearchCallbacks::startedNode(int d, char* s)
+void SearchCallbacks::startedNode(int d, char* s, int thread)
 {
     if (d+1 >= _verbose) return;
 
-    if (d<10) {
-	_leaveStart[d] = _leavesVisited;
-	_nodeStart[d] = _nodesVisited;
+    SearchStats& st = stats(thread);
+    if (d<SearchStats::maxDepth) {
+	st.leaveStart[d] = st.leaves;
+	st.nodeStart[d] = st.nodes;
     }
 
     static const char* spaces = "                     ";
     printf(" %sStarted node at depth %d (%s)\n", spaces+20-d, d, s);
 }
 
-void SearchCallbacks::finishedNode(int d, Move* chain)
+void SearchCallbacks::finishedNode(int d, Move* chain, int children, int thread)
 {
-    _nodesVisited++;
+    SearchStats& st = stats(thread);
+    st.finishedNode(d, children);
 
     if (d+1 >= _verbose) return;
 
@@ -152,12 +237,12 @@ void SearchCallbacks::finishedNode(int d, Move* chain)
     }
     printf("\n");
 
-    if (d<10) {
-	int l = _leavesVisited - _leaveStart[d];
-	int n = _nodesVisited - _nodeStart[d];
+    if (d<SearchStats::maxDepth) {
+	long long l = st.leaves - st.leaveStart[d];
+	long long n = st.nodes - st.nodeStart[d];
 	if (n<1) n=1;
-	printf(" %s %d leaves, %d nodes visited (%d leaves per node)\n", spaces+20-d,
-	       l,n, l/n);
+	printf(" %s %lld leaves, %lld nodes visited (%lld leaves per node)\n",
+	       spaces+20-d, l, n, l/n);
     }
 }
 
@@ -173,8 +258,18 @@ static SearchStrategy* searchStrategies = 0;
 SearchStrategy::SearchStrategy(const char* n, int prio)
 {
     _maxDepth = 1;
+    _msecsForSearch = 0;
+    _bestValue = 0;
     _sc = 0;
     _ev = 0;
+    _book = 0;
+    _tt = 0;
+    _solver = 0;
+    _historyMoveNo = 0;
+    _contempt = 0;
+    _multiPVLines = 1;
+    _deterministic = false;
+    _threads = 0;
     _name = n;
     _next = 0;
     _prio = prio;
@@ -249,7 +344,9 @@ Move& SearchStrategy::bestMove(Board* b)
 {
     if (_sc) {
 	int ms = b->msecsToPlay(b->actColor());
-	if (ms>0) {
+	if (_msecsForSearch>0)
+	    ms = _msecsForSearch;
+	else if (ms>0) {
 	    int minTokens = b->getColor1Count();
 	    int tokens = b->getColor2Count();
 	    if (tokens < minTokens) minTokens = tokens;
@@ -261,21 +358,95 @@ Move& SearchStrategy::bestMove(Board* b)
 
     _board = b;
     _bestMove.type = Move::none;
+    _bestValue = 0;
     _stopSearch = false;
+    _multiPV.clear();
+
+    // a lower move number means a new game
+    if (b->moveNo() < _historyMoveNo) _history.clear();
+    _historyMoveNo = b->moveNo();
+    _history.add(b->hashKey());
+
+    if (_book && _book->probe(b, _bestMove, &_bestValue)) {
+	if (_sc && _sc->verbose())
+	    printf(" Book move '%s'\n", _bestMove.name());
+    }
+    else {
+	if (_tt) _tt->newSearch();
+	// solver results depend on timing
+	bool solve = _solver && !_deterministic;
+	if (solve) _solver->start(b, _sc);
+	searchBestMove();
+	if (_tt) _tt->sync();
+	if (solve) solverResult();
+    }
+
+    // strategies without multi-PV support: best move only
+    if ((_multiPV.count() == 0) && (_bestMove.type != Move::none))
+	_multiPV.insert(_bestMove, _bestValue, pv(), 1);
 
-    searchBestMove();
+    if (_bestMove.type != Move::none) {
+	Board next = *b;
+	next.playMove(_bestMove);
+	_history.add(next.hashKey());
+    }
 
     if (_sc) _sc->finished(_bestMove);
 
     return _bestMove;
 }
 
+/* a result proven by the solver overrides the (stopped) search */
+void SearchStrategy::solverResult()
+{
+    int r = _solver->stop();
+    int value = (r == TacticalSolver::win) ? 15000 - _solver->plies() :
+	        (r == TacticalSolver::loss) ? _solver->plies() - 15000 : 0;
+
+    /* proofs are not shortest wins: keep a faster win of the search */
+    if ((r == TacticalSolver::win) && (value > _bestValue)) {
+	_bestMove = _solver->move();
+	_bestValue = value;
+	_multiPV.clear();
+    }
+    /* stopped search may have no or a partial result: play the move
+     * with the longest refutation */
+    else if (r == TacticalSolver::loss) {
+	_bestMove = _solver->move();
+	if (_bestValue > value) _bestValue = value;
+	_multiPV.clear();
+    }
+    if (!_sc || !_sc->verbose()) return;
+
+    if (r == TacticalSolver::win)
+	printf(" Solver: win with '%s' within %d plies (%lld nodes)\n",
+	       _solver->move().name(), _solver->plies(), _solver->nodes());
+    else if (r == TacticalSolver::loss)
+	printf(" Solver: loss within %d plies, longest after '%s' (%lld nodes)\n",
+	       _solver->plies(), _solver->move().name(), _solver->nodes());
+    else
+	printf(" Solver: no forced result (%lld nodes)\n", _solver->nodes());
+}
+
 Move& SearchStrategy::nextMove()
 {
     static Move m;
     return m; // returns invalid
 }
 
+Move* SearchStrategy::pv()
+{
+    _pvDefault[0] = _bestMove;
+    _pvDefault[1].type = Move::none;
+    return _pvDefault;
+}
+
+void SearchStrategy::stopSearch()
+{
+    _stopSearch = true;
+    if (_sc) _sc->requestStop();
+}
+
 int SearchStrategy::evaluate()
 {
     int v = _ev->calcEvaluation(_board); 
@@ -313,7 +484,10 @@ bool SearchStrategy::takeBack()
 
 void SearchStrategy::foundBestMove(int d, const Move& m, int eval)
 {
-    if (d==0) _bestMove = m;
+    if (d==0) {
+	_bestMove = m;
+	_bestValue = eval;
+    }
     if (_sc)
 	_sc->foundBestMove(d, m, eval);
 }
@@ -8,16 +8,91 @@
 #ifndef SEARCH_H
 #define SEARCH_H
 
+#include <stdio.h>
+#include <assert.h>
+#include <atomic>
+
 #include "move.h"
+#include "history.h"
 
 class Board;
 class Evaluator;
 class SearchStrategy;
+class OpeningBook;
+class TranspositionTable;
+class TacticalSolver;
+class SearchTracer;
+
+/**
+ * Statistics of one search thread
+ *
+ * Each thread counts into its own instance (see SearchCallbacks::stats),
+ * the instances are merged when the search is finished.
+ * Aligned to a cache line to avoid false sharing between threads.
+ */
+class alignas(64) SearchStats
+{
+ public:
+    enum { maxDepth = 20 };
+
+    SearchStats() { clear(); }
+
+    void clear();
+    void add(const SearchStats&);
+
+    /* node at depth d is finished after visiting <children> children */
+    void finishedNode(int d, int children)
+	{ nodes++; if (d<maxDepth) { depthNodes[d]++; depthChildren[d] += children; } }
+
+    /* effective branching factor at depth d (0 if unknown) */
+    double branchingFactor(int d) const;
+
+    /* Allow public R/W access... */
+    long long nodes, leaves, cutoffs, ttHits;
+    long long depthNodes[maxDepth], depthChildren[maxDepth];
+    /* counters at start of node at depth d, for verbose output */
+    long long leaveStart[maxDepth], nodeStart[maxDepth];
+};
+
+
+/**
+ * Result of a search for the best <k> root moves (multi-PV):
+ * moves with exact values (from view of side to move) and principal
+ * variations, best first.
+ */
+class MultiPV
+{
+ public:
+    enum { maxLines = 16 };
+
+    struct Line {
+	Move move;
+	int value;
+	Move pv[Variation::maxDepth]; // terminated by type none if shorter
+    };
+
+    MultiPV() { clear(); }
+
+    void clear() { _count = 0; }
+    int count() const { return _count; }
+    const Line& line(int i) const { return _line[i]; }
+
+    /* insert move with <value> and <pv>, keeping at most <k> best lines */
+    void insert(const Move& m, int value, const Move* pv, int k);
+
+ private:
+    Line _line[maxLines];
+    int _count;
+};
+
 
 class SearchCallbacks
 {
  public:
-    SearchCallbacks(int v = 0) { _verbose = v; }
+    enum { maxThreads = 128,
+	   pollInterval = 1024 }; // leaves between time checks of a thread
+
+    SearchCallbacks(int v = 0) { _verbose = v; _json = 0; _tracer = 0; _stop = false; }
     virtual ~SearchCallbacks() {}
     
     // called at beginning of new search. If <msecs> >0,
@@ -27,26 +102,57 @@ class SearchCallbacks
     virtual void substart(char*);
     // called after search is done
     virtual void finished(Move&);
-    // called after each evaluation
+    // called after each evaluation in search thread <thread>
     // returns true to request stop of search
-    virtual bool afterEval();
+    virtual bool afterEval(int thread = 0);
     // called when a new best move is found at depth d
     virtual void foundBestMove(int d, const Move&, int value);
     // called before children are visited
-    virtual void startedNode(int d, char*);
+    virtual void startedNode(int d, char*, int thread = 0);
     /**
      * Called after needed children are visited
-     * Second parameter gives array of best move sequence found
+     * Second parameter gives array of best move sequence found,
+     * third the number of children visited (for branching factor)
      */
-    virtual void finishedNode(int d, Move*);
+    virtual void finishedNode(int d, Move*, int children = 0, int thread = 0);
+
+    /**
+     * Check if time for search is over, and if so, set stop flag.
+     * Uses a monotonic clock; can be called from any thread.
+     */
+    bool timeIsUp();
+    bool stopRequested() { return _stop; }
+    void requestStop() { _stop = true; }
+
+    /* statistics of search thread <t> (below maxThreads: strategies
+     * limit their teams to that), and merged ones after finished() */
+    SearchStats& stats(int t = 0) {
+	assert((t >= 0) && (t < maxThreads));
+	return _stats[t];
+    }
+    SearchStats& total() { return _total; }
+
+    /* write statistics of each search as JSON line into file */
+    void setJSONOutput(FILE* f) { _json = f; }
+    void printJSON(FILE*, const Move&);
+
+    /* record sampled nodes of each search (see trace.h); 0: none */
+    void setTracer(SearchTracer* t) { _tracer = t; }
+    SearchTracer* tracer() { return _tracer; }
 
     int msecsPassed() { return _msecsPassed; }
     int verbose() { return _verbose; }
 
  private:
     int _verbose;
-    int _leavesVisited, _nodesVisited;
     int _msecsPassed, _msecsForSearch;
+    long long _usecsStart, _usecsReported;
+    std::atomic<bool> _stop;
+    FILE* _json;
+    SearchTracer* _tracer;
+
+    SearchStats _total;
+    SearchStats _stats[maxThreads];
 };
 
 
@@ -71,6 +177,25 @@ class SearchStrategy
     void registerCallbacks(SearchCallbacks* sc) { _sc = sc; }
     void setMaxDepth(int d) { _maxDepth = d; }
     void setEvaluator(Evaluator* e) { _ev = e; }
+    /* opening book probed before each search (0: none) */
+    void setBook(OpeningBook* b) { _book = b; }
+    /* cache of search results kept between searches (0: none) */
+    void setTranspositionTable(TranspositionTable* tt) { _tt = tt; }
+    /* helper threads proving forced wins while searching (0: none) */
+    void setSolver(TacticalSolver* s) { _solver = s; }
+    /* value of a draw by repetition for us is -<contempt> */
+    void setContempt(int c) { _contempt = c; }
+    /* search for best <k> root moves with exact values, if supported */
+    void setMultiPV(int k)
+	{ _multiPVLines = (k<1) ? 1 : (k>MultiPV::maxLines) ? MultiPV::maxLines : k; }
+    /* fixed time for each search; if 0, derive it from time left on board */
+    void setMSecsForSearch(int ms) { _msecsForSearch = ms; }
+    /* same result and node counts in each run and with any number of
+     * threads, if supported; for searches limited by depth only.
+     * The solver is not used then. */
+    void setDeterministic(bool d) { _deterministic = d; }
+    /* threads used by one search, if parallel (0: default of strategy) */
+    void setThreads(int t) { _threads = t; }
 
     /* Start search and return best move. */
     Move& bestMove(Board*);
@@ -78,10 +203,25 @@ class SearchStrategy
     /* return best move in depth 1 if last search got one */
     virtual Move& nextMove();
 
+    /* value of best move of last search, from view of side to move */
+    int bestValue() { return _bestValue; }
+
+    /* Principal variation of last search: at most Variation::maxDepth
+     * moves, terminated by a move of type Move::none if shorter.
+     * Default only contains the best move.
+     */
+    virtual Move* pv();
+
+    /* Best root moves of last search. Strategies not supporting
+     * multi-PV only give the best move with its principal variation.
+     */
+    const MultiPV& multiPV() { return _multiPV; }
+
     /* factory method: should return instance of derived class */
     virtual SearchStrategy* clone() = 0;
 
-    void stopSearch() { _stopSearch = true; }
+    /* request stop of a running search */
+    void stopSearch();
 
  protected:
     /**
@@ -108,6 +248,14 @@ class SearchStrategy
     void finishedNode(int d, Move* bestList);
     // see Evaluator::calcEvaluation
     int evaluate();
+    // wait for solver, and take its result
+    void solverResult();
+
+    /* position <key> repeats one on the search <path> or of the game? */
+    bool isRepetition(unsigned long long key, const KeyStack& path)
+	{ return path.repeats(key) || _history.contains(key); }
+    /* value of a draw for the side to move at <depth> (0: root) */
+    int drawValue(int depth) { return (depth % 2) ? _contempt : -_contempt; }
 
 
     int _maxDepth;
@@ -115,12 +263,27 @@ class SearchStrategy
     bool _stopSearch;
     SearchCallbacks* _sc;
     Evaluator* _ev;
+    OpeningBook* _book;
+    TranspositionTable* _tt;
+    TacticalSolver* _solver;
+    /* positions of current game, and move number of last search */
+    GameHistory _history;
+    int _historyMoveNo;
+    int _contempt;
+    /* lines requested, and result */
+    int _multiPVLines;
+    MultiPV _multiPV;
     Move _bestMove;
+    int _bestValue;
+    int _msecsForSearch;
+    bool _deterministic;
+    int _threads;
 
  private:
     const char* _name;
     int _prio;
     SearchStrategy* _next;
+    Move _pvDefault[2];
 };
 
 
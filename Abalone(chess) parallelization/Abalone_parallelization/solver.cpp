@@ -0,0 +1,284 @@
+/**
+ * TacticalSolver: proves forced wins by pushing out tokens
+ */
+
+#include <stdio.h>
+
+#include "solver.h"
+#include "search.h"
+
+TacticalSolver::TacticalSolver()
+{
+    _threadCount = 0;
+    _maxPlies = 11;
+    _thread = 0;
+    _tree = 0;
+    _sc = 0;
+    _itemCount = 0;
+    _lossItems = 0;
+    _result = unknown;
+    _plies = 0;
+    _nodes = 0;
+    _stop = false;
+}
+
+TacticalSolver::~TacticalSolver()
+{
+    stop();
+    setThreads(0);
+}
+
+void TacticalSolver::setThreads(int n)
+{
+    for(int t=0; t<_threadCount; t++)
+	delete[] _tree[t];
+    delete[] _tree;
+    _tree = 0;
+    _threadCount = (n > 0) ? n : 0;
+    if (_threadCount == 0) return;
+
+    // trees are allocated on first use by each thread
+    _tree = new Node*[_threadCount];
+    for(int t=0; t<_threadCount; t++)
+	_tree[t] = 0;
+}
+
+void TacticalSolver::start(Board* b, SearchCallbacks* sc)
+{
+    _result = unknown;
+    _move.type = Move::none;
+    _plies = 0;
+    _nodes = 0;
+    if (_threadCount == 0 || _thread) return;
+
+    _board = *b;
+    _sc = sc;
+    _stop = false;
+    _nextItem = 0;
+    _lossProven = 0;
+    _lossLongest = 0;
+    _lossFailed = false;
+
+    /* forcing moves prove a win, all moves together a loss */
+    MoveList list;
+    Move m;
+    _itemCount = 0;
+    _board.generateMoves(list);
+    while(list.getNext(m, Move::maxPushType)) {
+	_item[_itemCount].move = m;
+	_item[_itemCount++].win = true;
+    }
+    list.clear();
+    _board.generateMoves(list);
+    _lossItems = 0;
+    while(list.getNext(m)) {
+	_item[_itemCount].move = m;
+	_item[_itemCount++].win = false;
+	_lossItems++;
+    }
+
+    _thread = new std::thread[_threadCount];
+    for(int t=0; t<_threadCount; t++)
+	_thread[t] = std::thread(&TacticalSolver::work, this, t);
+}
+
+int TacticalSolver::stop()
+{
+    if (!_thread) return _result;
+
+    _stop = true;
+    for(int t=0; t<_threadCount; t++)
+	_thread[t].join();
+    delete[] _thread;
+    _thread = 0;
+
+    return _result;
+}
+
+void TacticalSolver::found(int result, const Move& m, int plies)
+{
+    int r = unknown;
+    if (!_result.compare_exchange_strong(r, result)) return;
+
+    _move = m;
+    _plies = plies;
+    _stop = true;
+    if (_sc) _sc->requestStop();
+}
+
+void TacticalSolver::work(int thread)
+{
+    if (!_tree[thread]) _tree[thread] = new Node[nodesPerThread];
+    Node* tree = _tree[thread];
+    Board b = _board;
+
+    while(!_stop) {
+	int i = _nextItem++;
+	if (i >= _itemCount) break;
+
+	Item& it = _item[i];
+	if (!it.win && _lossFailed) continue;
+
+	int plies = 0, r;
+	b.playMove(it.move);
+	if (!b.isValid())
+	    // move wins immediately
+	    r = it.win ? win : loss;
+	else
+	    // after a forcing move, we are attacker with opponent to move;
+	    // for a loss, opponent is attacker
+	    r = prove(b, tree, !it.win, plies);
+	b.takeBack();
+
+	if (it.win) {
+	    if (r == win) found(win, it.move, plies+1);
+	    continue;
+	}
+	if (r != win) {
+	    _lossFailed = true;
+	    continue;
+	}
+	int l = ((plies+1) << 16) | i, p = _lossLongest;
+	while((l > p) && !_lossLongest.compare_exchange_weak(p, l));
+	if (++_lossProven == _lossItems) {
+	    l = _lossLongest;
+	    found(loss, _item[l & 0xffff].move, l >> 16);
+	}
+    }
+}
+
+/* proof and disproof numbers of node <n> from its children */
+void TacticalSolver::update(Node* tree, int n)
+{
+    Node& node = tree[n];
+    int minValue = infinity, sum = 0;
+
+    for(int i=0; i<node.childCount; i++) {
+	Node& c = tree[node.firstChild + i];
+	int v = node.attacker ? c.proof : c.disproof;
+	int s = node.attacker ? c.disproof : c.proof;
+	if (v < minValue) minValue = v;
+	sum += s;
+	if (sum > infinity) sum = infinity;
+    }
+    if (node.attacker)
+	node.proof = minValue, node.disproof = sum;
+    else
+	node.disproof = minValue, node.proof = sum;
+}
+
+bool TacticalSolver::expand(Board& b, Node* tree, int n, int& count)
+{
+    Node& node = tree[n];
+    MoveList list;
+    Move m;
+
+    /* attacker only plays forcing moves */
+    int maxType = node.attacker ? Move::maxPushType : Move::maxMoveType;
+    b.generateMoves(list);
+    if (count + list.count(maxType) > nodesPerThread) return false;
+
+    node.firstChild = count;
+    node.childCount = 0;
+    while(list.getNext(m, maxType)) {
+	Node& c = tree[count++];
+	node.childCount++;
+	c.move = m;
+	c.parent = n;
+	c.firstChild = -1;
+	c.childCount = 0;
+	c.attacker = !node.attacker;
+	c.ply = node.ply + 1;
+	c.proof = c.disproof = 1;
+
+	b.playMove(m);
+	if (!b.isValid()) {
+	    /* player of <m> won */
+	    c.proof = node.attacker ? 0 : infinity;
+	    c.disproof = node.attacker ? infinity : 0;
+	}
+	else if (c.ply >= _maxPlies) {
+	    /* no win for attacker within ply limit */
+	    c.proof = infinity;
+	    c.disproof = 0;
+	}
+	b.takeBack();
+
+	// one escape of the defender, or one winning move is enough
+	if (node.attacker ? (c.proof == 0) : (c.disproof == 0)) break;
+    }
+
+    if (node.childCount == 0) {
+	/* attacker without forcing moves */
+	node.proof = node.attacker ? infinity : 0;
+	node.disproof = node.attacker ? 0 : infinity;
+    }
+    else
+	update(tree, n);
+    return true;
+}
+
+int TacticalSolver::prove(Board& b, Node* tree, bool attacker, int& plies)
+{
+    Node& root = tree[0];
+    root.move.type = Move::none;
+    root.parent = -1;
+    root.firstChild = -1;
+    root.childCount = 0;
+    root.attacker = attacker;
+    root.ply = 1;
+    root.proof = root.disproof = 1;
+    int count = 1;
+
+    while(root.proof && root.disproof && !_stop) {
+	if (attacker && _lossFailed) break;
+
+	/* select most proving node */
+	int n = 0;
+	while(tree[n].firstChild >= 0) {
+	    Node& node = tree[n];
+	    int c = node.firstChild;
+	    for(int i=1; i<node.childCount; i++) {
+		Node& child = tree[node.firstChild + i];
+		if (node.attacker ? (child.proof < tree[c].proof) :
+		    (child.disproof < tree[c].disproof))
+		    c = node.firstChild + i;
+	    }
+	    b.playMove(tree[c].move);
+	    n = c;
+	}
+
+	bool expanded = expand(b, tree, n, count);
+
+	/* back to root, updating proof numbers */
+	while(n > 0) {
+	    b.takeBack();
+	    n = tree[n].parent;
+	    update(tree, n);
+	}
+	if (!expanded) break;
+    }
+    _nodes += count;
+
+    if (root.proof == 0) {
+	plies = proofPlies(tree, 0);
+	return win;
+    }
+    return (root.disproof == 0) ? loss : unknown;
+}
+
+/* length of longest line in proof tree below node <n> */
+int TacticalSolver::proofPlies(Node* tree, int n)
+{
+    Node& node = tree[n];
+    if (node.firstChild < 0) return 0;
+
+    int plies = node.attacker ? infinity : 0;
+    for(int i=0; i<node.childCount; i++) {
+	int c = node.firstChild + i;
+	if (tree[c].proof != 0) continue;
+	int p = 1 + proofPlies(tree, c);
+	if (node.attacker ? (p < plies) : (p > plies)) plies = p;
+    }
+    return plies;
+}
@@ -0,0 +1,108 @@
+/**
+ * TacticalSolver: proves forced wins by pushing out tokens
+ *
+ * The solver only looks at forcing moves of the attacking side (moves
+ * pushing opponent tokens, see Move::isPushMove) and at all replies of
+ * the defender, but to a much greater depth than the main search.
+ * It uses proof-number search: the tree is grown best-first at the
+ * node which most cheaply proves or disproves the win.
+ *
+ * It runs in helper threads during a normal search. Work items are the
+ * moves of the side to move: a forcing move proves a win if the opponent
+ * can not escape afterwards; all moves together prove a loss if after
+ * each of them, the opponent has a forced win. A proven result stops
+ * the main search via SearchCallbacks::requestStop. For a loss, the
+ * move whose refutation is longest is kept: the opponent may still
+ * miss the win.
+ */
+
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <atomic>
+#include <thread>
+
+#include "move.h"
+#include "board.h"
+
+class SearchCallbacks;
+
+class TacticalSolver
+{
+ public:
+    /* result of solving a position, for the side to move */
+    enum { unknown = 0, win, loss };
+
+    TacticalSolver();
+    ~TacticalSolver();
+
+    /* number of helper threads (0: solver is off) */
+    void setThreads(int n);
+    int threads() { return _threadCount; }
+    /* maximal number of plies searched from the position */
+    void setMaxPlies(int p) { _maxPlies = p; }
+
+    /**
+     * Start helper threads solving position <b>. If a result is
+     * proven, the search using <sc> is requested to stop.
+     */
+    void start(Board* b, SearchCallbacks* sc = 0);
+    /* stop helper threads and return result */
+    int stop();
+
+    int result() { return _result; }
+    /* winning move if result is a win, move losing slowest if a loss */
+    Move& move() { return _move; }
+    /* plies to the end of the game, if proven */
+    int plies() { return _plies; }
+    /* nodes of proof trees created */
+    long long nodes() { return _nodes; }
+
+ private:
+    enum { nodesPerThread = 1<<19,
+	   infinity = 1<<28 };
+
+    /* node of a proof tree; children of a node are stored in one block */
+    struct Node {
+	Move move;
+	int proof, disproof;
+	int parent, firstChild;
+	short childCount;
+	bool attacker;   // attacker to move (OR node)
+	char ply;
+    };
+
+    struct Item {
+	Move move;
+	bool win;        // proving a win, otherwise a loss
+    };
+
+    void work(int thread);
+    /* proof-number search in position <b>, with attacker to move if
+     * <attacker>; returns result for attacker and plies to win */
+    int prove(Board& b, Node* tree, bool attacker, int& plies);
+    bool expand(Board& b, Node* tree, int n, int& count);
+    void update(Node* tree, int n);
+    int proofPlies(Node* tree, int n);
+    void found(int result, const Move& m, int plies);
+
+    int _threadCount, _maxPlies;
+    std::thread* _thread;
+    Node** _tree;
+    Board _board;
+    SearchCallbacks* _sc;
+
+    Item _item[2*MoveList::MaxMoves];
+    int _itemCount, _lossItems;
+    std::atomic<int> _nextItem, _lossProven;
+    // longest refutation of loss items: (plies << 16) | item
+    std::atomic<int> _lossLongest;
+    std::atomic<bool> _lossFailed, _stop;
+
+    std::atomic<int> _result;
+    Move _move;
+    int _plies;
+    std::atomic<long long> _nodes;
+};
+
+#endif
@@ -286,13 +286,7 @@ int main(int argc, char* argv[])
     if (sendStart) {
 	static Board boardToSend;
 	if (file) {
-	    char tmp[500];
-	    int len = 0, c;
-	    while( len<499 && (c=fgetc(file)) != EOF)
-		tmp[len++] = (char) c;
-	    tmp[len++]=0;
-
-	    if (!boardToSend.setState(tmp)) {
+	    if (!boardToSend.readState(file)) {
 		printf("%s: WARNING - Can not parse given position; using start position\n", argv[0]);
 		boardToSend.begin(Board::color1);
 	    }
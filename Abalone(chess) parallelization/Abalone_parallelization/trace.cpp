@@ -0,0 +1,92 @@
+/**
+ * Search tracer: sampled records of search tree nodes
+ */
+
+#include <string.h>
+
+#include "trace.h"
+
+static const char traceMagic[8] = { 'A','B','T','R','A','C','E','1' };
+
+static_assert(sizeof(TraceEvent) == 28, "trace format changed");
+
+
+TraceRing::TraceRing(int thread, int shift)
+{
+    _count = 0;
+    _thread = thread;
+    _mask = (1u << shift) - 1;
+    // xorshift state must not be 0
+    _random = 2463534242u + thread;
+}
+
+
+SearchTracer::SearchTracer()
+{
+    _file = 0;
+    _shift = 0;
+    for(int t=0; t<maxThreads; t++) _ring[t] = 0;
+}
+
+bool SearchTracer::open(const char* file, int shift)
+{
+    close();
+    _file = fopen(file, "ab");
+    _shift = (shift < 0) ? 0 : (shift > 30) ? 30 : shift;
+    return _file != 0;
+}
+
+void SearchTracer::close()
+{
+    if (_file) fclose(_file);
+    _file = 0;
+    for(int t=0; t<maxThreads; t++) {
+	delete _ring[t];
+	_ring[t] = 0;
+    }
+}
+
+TraceRing* SearchTracer::ring(int t)
+{
+    if (!_file || (t >= maxThreads)) return 0;
+    if (!_ring[t]) _ring[t] = new TraceRing(t, _shift);
+    return _ring[t];
+}
+
+void SearchTracer::start()
+{
+    for(int t=0; t<maxThreads; t++)
+	if (_ring[t]) _ring[t]->clear();
+}
+
+void SearchTracer::write()
+{
+    if (!_file) return;
+
+    unsigned int threads = 0, events = 0, dropped = 0;
+    for(int t=0; t<maxThreads; t++) {
+	if (!_ring[t]) continue;
+	threads = t+1;
+	events += _ring[t]->count();
+	dropped += (unsigned int) _ring[t]->dropped();
+    }
+
+    char h[8 + 4*4];
+    unsigned int n[4] = { (unsigned int) _shift, threads, events, dropped };
+    memcpy(h, traceMagic, sizeof(traceMagic));
+    memcpy(h+8, n, sizeof(n));
+    fwrite(h, sizeof(h), 1, _file);
+
+    for(int t=0; t<maxThreads; t++) {
+	if (!_ring[t]) continue;
+	TraceRing& r = *_ring[t];
+	// events wrapping around the end of the ring are written in two parts
+	int count = r.count();
+	int first = count - ((count == TraceRing::capacity) ?
+			     (int) ((r.dropped() + count) & (TraceRing::capacity-1)) : 0);
+	fwrite(&r.event(0), sizeof(TraceEvent), first, _file);
+	if (first < count)
+	    fwrite(&r.event(first), sizeof(TraceEvent), count - first, _file);
+    }
+    fflush(_file);
+}
@@ -0,0 +1,104 @@
+/**
+ * Search tracer: sampled records of search tree nodes
+ *
+ * While searching, each thread appends events for a sample of the nodes
+ * it expands (1 of 2^<shift> nodes, chosen at random) into its own ring
+ * buffer: window and result of the node, children available and visited,
+ * which child gave a cutoff, and the leaves below the node. Only the
+ * owning thread writes into a ring, so no locks or atomics are needed;
+ * if a ring is full, the oldest events are overwritten.
+ *
+ * After each search, the events of all threads are appended to the
+ * trace file as one record:
+ *
+ *   header: magic "ABTRACE1" (8 bytes), then 32-bit numbers: sample
+ *           shift, threads, events, and events dropped (overwritten)
+ *   events: TraceEvent, thread by thread, oldest first
+ *
+ * Numbers are in the byte order of the machine writing the trace.
+ * Traces are written by "player --trace", and analyzed by "tracestat".
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdio.h>
+
+/* one expanded node; values from view of the side to move */
+struct TraceEvent {
+    int alpha, beta;         // window when the node was entered
+    int value;               // result
+    unsigned int leaves;     // leaves below the node
+    unsigned int wasted;     // of these, leaves before the child giving the cutoff
+    unsigned char depth;     // 0: root
+    unsigned char thread;
+    unsigned char moves;     // children available
+    unsigned char played;    // children visited
+    unsigned char cutoff;    // number of child giving a cutoff (0: none)
+    unsigned char unused[3];
+};
+
+/* events of one search thread */
+class alignas(64) TraceRing
+{
+ public:
+    enum { capacity = 1 << 14 };
+
+    TraceRing(int thread, int shift);
+
+    /* is the next node in the sample? */
+    bool sample() {
+	_random ^= _random << 13;
+	_random ^= _random >> 17;
+	_random ^= _random << 5;
+	return (_random & _mask) == 0;
+    }
+    /* event to fill in for a sampled node */
+    TraceEvent& add() { return _event[_count++ & (capacity-1)]; }
+
+    int thread() { return _thread; }
+    void clear() { _count = 0; }
+    /* events in the ring, and events overwritten */
+    int count() { return (_count < capacity) ? (int) _count : capacity; }
+    long long dropped() { return (_count < capacity) ? 0 : _count - capacity; }
+    /* <i>-th oldest event in the ring */
+    const TraceEvent& event(int i)
+	{ return _event[(_count - count() + i) & (capacity-1)]; }
+
+ private:
+    TraceEvent _event[capacity];
+    long long _count;
+    unsigned int _random, _mask;
+    int _thread;
+};
+
+class SearchTracer
+{
+ public:
+    enum { maxThreads = 128 };
+
+    SearchTracer();
+    ~SearchTracer() { close(); }
+
+    /* append records to <file>, sampling 1 of 2^<shift> nodes;
+     * returns false if it can not be opened */
+    bool open(const char* file, int shift);
+    void close();
+    bool isOpen() { return _file != 0; }
+
+    /* ring of search thread <t>: call from that thread, so that the
+     * ring is allocated in memory local to it */
+    TraceRing* ring(int t);
+
+    /* start a new search: forget events of the previous one */
+    void start();
+    /* append events of the search as one record */
+    void write();
+
+ private:
+    FILE* _file;
+    int _shift;
+    TraceRing* _ring[maxThreads];
+};
+
+#endif
@@ -0,0 +1,153 @@
+/**
+ * Statistics of search traces
+ *
+ * Reads traces written by "player --trace" (see trace.h) and prints, per
+ * depth, how many children of a node are searched and how often the
+ * first child already gives a cutoff, and per thread, how much of its
+ * work was spent on children before the one giving a cutoff (which a
+ * perfect move ordering would not search).
+ *
+ * Nodes are sampled at random, so counts are estimates: multiply by the
+ * sample rate. Leaves are counted at every depth, so leaves of different
+ * depths must not be added.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "trace.h"
+
+static char* traceFile = 0;
+static int onlySearch = 0;
+
+static void printHelp(char* prg)
+{
+    printf("TraceStat V 0.1\n"
+	   "Print node statistics of search traces.\n\n");
+    printf("Usage: %s [options] <file>\n\n"
+	   "  <file>           Trace written by \"player --trace\"\n\n", prg);
+    printf(" Options:\n"
+	   "  -h / --help      Print this help text\n"
+	   "  -n <search>      Only use search with this number (starting at 1)\n\n");
+    exit(1);
+}
+
+static void parseArgs(int argc, char* argv[])
+{
+    int arg=0;
+    while(arg+1<argc) {
+	arg++;
+	if (strcmp(argv[arg],"-h")==0 ||
+	    strcmp(argv[arg],"--help")==0) printHelp(argv[0]);
+	if (argv[arg][0] != '-') {
+	    traceFile = argv[arg];
+	    continue;
+	}
+	if ((strcmp(argv[arg],"-n")==0) && (arg+1<argc)) {
+	    onlySearch = atoi(argv[++arg]);
+	    continue;
+	}
+	printf("ERROR - Unknown option %s\n", argv[arg]);
+	printHelp(argv[0]);
+    }
+    if (!traceFile) printHelp(argv[0]);
+}
+
+/* sums over sampled nodes */
+struct NodeStats {
+    long long nodes, moves, played, cutNodes, firstCutoffs;
+    long long leaves, wasted;
+
+    NodeStats() { nodes = moves = played = cutNodes = firstCutoffs = leaves = wasted = 0; }
+    void add(const TraceEvent& e) {
+	nodes++;
+	moves += e.moves;
+	played += e.played;
+	if (e.cutoff > 0) cutNodes++;
+	if (e.cutoff == 1) firstCutoffs++;
+	leaves += e.leaves;
+	wasted += e.wasted;
+    }
+};
+
+static double ratio(long long a, long long b)
+{
+    return (b > 0) ? (double) a / b : 0.0;
+}
+
+int main(int argc, char* argv[])
+{
+    enum { maxDepth = 256, maxThreads = SearchTracer::maxThreads };
+
+    parseArgs(argc, argv);
+
+    FILE* f = fopen(traceFile, "rb");
+    if (!f) {
+	printf("ERROR - Can not open '%s' for reading a trace\n", traceFile);
+	return 1;
+    }
+
+    static NodeStats depthStats[maxDepth], threadStats[maxThreads];
+    NodeStats total;
+    long long dropped = 0;
+    int searches = 0, used = 0, shift = 0, threads = 0;
+
+    char h[8 + 4*4];
+    unsigned int n[4];
+    while(fread(h, sizeof(h), 1, f) == 1) {
+	if (memcmp(h, "ABTRACE1", 8) != 0) {
+	    printf("ERROR - '%s' is no search trace\n", traceFile);
+	    return 1;
+	}
+	memcpy(n, h+8, sizeof(n));
+	searches++;
+
+	bool use = !onlySearch || (searches == onlySearch);
+	if (!use) {
+	    fseek(f, (long) n[2] * sizeof(TraceEvent), SEEK_CUR);
+	    continue;
+	}
+	used++;
+	shift = n[0];
+	if ((int) n[1] > threads) threads = n[1];
+	dropped += n[3];
+
+	TraceEvent e;
+	for(unsigned int i=0; i<n[2]; i++) {
+	    if (fread(&e, sizeof(e), 1, f) != 1) break;
+	    depthStats[e.depth].add(e);
+	    if (e.thread < maxThreads) threadStats[e.thread].add(e);
+	    total.add(e);
+	}
+    }
+    fclose(f);
+
+    printf("Trace '%s': %d searches, %d used, %lld nodes sampled (1 of %d), %lld dropped\n\n",
+	   traceFile, searches, used, total.nodes, 1 << shift, dropped);
+    if (total.nodes == 0) return 0;
+
+    printf(" Depth      Nodes   Moves  Played  Cut nodes  First cutoffs  Leaves/node  Wasted\n");
+    for(int d=0; d<maxDepth; d++) {
+	NodeStats& s = depthStats[d];
+	if (s.nodes == 0) continue;
+	printf(" %5d %10lld %7.1f %7.2f %9.1f%% %13.1f%% %12.0f %6.1f%%\n",
+	       d, s.nodes, ratio(s.moves, s.nodes), ratio(s.played, s.nodes),
+	       100.0 * ratio(s.cutNodes, s.nodes), 100.0 * ratio(s.firstCutoffs, s.cutNodes),
+	       ratio(s.leaves, s.nodes), 100.0 * ratio(s.wasted, s.leaves));
+    }
+
+    printf("\n Thread      Nodes  Share  Played  First cutoffs  Wasted\n");
+    for(int t=0; t<threads; t++) {
+	NodeStats& s = threadStats[t];
+	if (s.nodes == 0) continue;
+	printf(" %6d %10lld %5.1f%% %7.2f %13.1f%% %6.1f%%\n",
+	       t, s.nodes, 100.0 * ratio(s.nodes, total.nodes), ratio(s.played, s.nodes),
+	       100.0 * ratio(s.firstCutoffs, s.cutNodes), 100.0 * ratio(s.wasted, s.leaves));
+    }
+
+    printf("\n Played: children searched per node (effective branching factor)\n"
+	   " First cutoffs: cutoffs given by the first child searched\n"
+	   " Wasted: leaves below children searched before the one giving a cutoff\n");
+    return 0;
+}
@@ -0,0 +1,255 @@
+/**
+ * TranspositionTable: cache of search results, shared by threads
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tt.h"
+#include "board.h"
+
+static const char ttMagic[8] = { 'A','B','T','T','0','0','0','2' };
+
+/* entries start at this offset in the mapping, aligned to cache line */
+static const long headerSize = 64;
+
+/* Layout of entry data:
+ * bits  0-15: value + 32768,  16-23: depth,  24-25: bound,
+ * bits 34-40: move field,     41-43: move direction,
+ * bits 44-47: move type,      48-63: generation
+ * Data 0 is an empty entry (bound none).
+ */
+static const unsigned int generationMask = 0xffff;
+
+static inline unsigned long long pack(int value, int depth, int bound,
+				      int generation, const Move& m)
+{
+    return (unsigned long long) (value + 32768) |
+	((unsigned long long) depth << 16) |
+	((unsigned long long) bound << 24) |
+	((unsigned long long) (m.field & 0x7f) << 34) |
+	((unsigned long long) (m.direction & 7) << 41) |
+	((unsigned long long) (m.type & 0xf) << 44) |
+	((unsigned long long) (generation & generationMask) << 48);
+}
+
+static inline int dataValue(unsigned long long d)      { return (int)(d & 0xffff) - 32768; }
+static inline int dataDepth(unsigned long long d)      { return (int)(d >> 16) & 0xff; }
+static inline int dataBound(unsigned long long d)      { return (int)(d >> 24) & 3; }
+static inline int dataGeneration(unsigned long long d) { return (int)(d >> 48) & generationMask; }
+
+static inline Move dataMove(unsigned long long d)
+{
+    return Move((short)((d >> 34) & 0x7f), (char)((d >> 41) & 7),
+		(Move::MoveType)((d >> 44) & 0xf));
+}
+
+
+TranspositionTable::TranspositionTable()
+{
+    _header = 0;
+    _entry = 0;
+    _mask = 0;
+    _map = 0;
+    _mapSize = 0;
+    _mbytes = 0;
+    _file = false;
+    _symmetric = false;
+}
+
+bool TranspositionTable::create(int mbytes, const char* file, bool symmetric)
+{
+    close();
+    if (mbytes < 1) return false;
+
+    unsigned long long n = 1;
+    while(2 * n * bucketSize * sizeof(Entry) <= (unsigned long long) mbytes << 20)
+	n *= 2;
+    long size = headerSize + n * bucketSize * sizeof(Entry);
+
+    void* map;
+    bool reuse = false;
+    if (file) {
+	int fd = ::open(file, O_RDWR | O_CREAT, 0644);
+	if (fd<0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) < 0) {
+	    ::close(fd);
+	    return false;
+	}
+	reuse = (st.st_size == size);
+	if (!reuse && (ftruncate(fd, size) < 0)) {
+	    ::close(fd);
+	    return false;
+	}
+	map = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+    }
+    else
+	map = mmap(0, size, PROT_READ | PROT_WRITE,
+		   MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) return false;
+
+    _map = map;
+    _mapSize = size;
+    _header = (Header*) map;
+    _entry = (Entry*) ((char*) map + headerSize);
+    _mask = n-1;
+    _mbytes = mbytes;
+    _file = (file != 0);
+    _symmetric = symmetric;
+    unsigned int flags = symmetric ? symmetricKeys : 0;
+
+    /* content of a file written with another layout is not usable */
+    if (reuse)
+	reuse = (memcmp(_header->magic, ttMagic, sizeof(ttMagic)) == 0) &&
+	    (_header->buckets == n) && (_header->flags == flags);
+    if (!reuse) {
+	memcpy(_header->magic, ttMagic, sizeof(ttMagic));
+	_header->buckets = n;
+	_header->generation = 0;
+	_header->valueGeneration = 0;
+	_header->flags = flags;
+	clear();
+    }
+    return true;
+}
+
+void TranspositionTable::close()
+{
+    if (_map) {
+	sync();
+	munmap(_map, _mapSize);
+    }
+    _header = 0;
+    _entry = 0;
+    _map = 0;
+    _mapSize = 0;
+    _mbytes = 0;
+    _file = false;
+    _symmetric = false;
+}
+
+void TranspositionTable::newSearch()
+{
+    if (!_header) return;
+    unsigned int g = (_header->generation.fetch_add(1) + 1) & generationMask;
+    // after all generations are used, entries as old as this could be
+    // taken for current ones, even if their values were invalidated
+    if (g == 0) {
+	clear();
+	_header->valueGeneration = 0;
+    }
+}
+
+void TranspositionTable::invalidateValues()
+{
+    if (_header)
+	_header->valueGeneration = (_header->generation + 1) & generationMask;
+}
+
+void TranspositionTable::clear()
+{
+    if (!_entry) return;
+    for(unsigned long long i=0; i<(_mask+1)*bucketSize; i++) {
+	_entry[i].check.store(0, std::memory_order_relaxed);
+	_entry[i].data.store(0, std::memory_order_relaxed);
+    }
+}
+
+void TranspositionTable::sync()
+{
+    if (_file && _map)
+	msync(_map, _mapSize, MS_ASYNC);
+}
+
+unsigned long long TranspositionTable::key(Board* b, int& symmetry)
+{
+    symmetry = 0;
+    return _symmetric ? b->canonicalKey(&symmetry) : b->hashKey();
+}
+
+unsigned long long TranspositionTable::key(Board* b, unsigned long long hash, int& symmetry)
+{
+    symmetry = 0;
+    return _symmetric ? b->canonicalKey(&symmetry) : hash;
+}
+
+bool TranspositionTable::probe(unsigned long long key, int symmetry, int depth,
+			       int alpha, int beta, int& value, Move& m)
+{
+    m.type = Move::none;
+    if (!_entry) return false;
+
+    Entry* e = _entry + (key & _mask) * bucketSize;
+    for(int i=0; i<bucketSize; i++) {
+	unsigned long long data = e[i].data.load(std::memory_order_relaxed);
+	unsigned long long check = e[i].check.load(std::memory_order_relaxed);
+	if ((data == 0) || ((check ^ data) != key)) continue;
+
+	m = dataMove(data);
+	if (symmetry) m = Board::symmetricMove(m, Board::inverseSymmetry(symmetry));
+	if (dataDepth(data) < depth) return false;
+
+	/* value stored before evaluation changed? */
+	unsigned int generation = _header->generation;
+	int age = (generation - dataGeneration(data)) & generationMask;
+	if (age > (int)((generation - _header->valueGeneration) & generationMask))
+	    return false;
+
+	int v = dataValue(data);
+	int bound = dataBound(data);
+	if ((bound == exact) ||
+	    ((bound == lower) && (v >= beta)) ||
+	    ((bound == upper) && (v <= alpha))) {
+	    value = v;
+	    return true;
+	}
+	return false;
+    }
+    return false;
+}
+
+void TranspositionTable::store(unsigned long long key, int symmetry, int depth,
+			       int value, int bound, const Move& m)
+{
+    if (!_entry || (bound == none)) return;
+    if ((value < -32767) || (value > 32767) || (depth < 0) || (depth > 255))
+	return;
+
+    int generation = _header->generation & generationMask;
+    unsigned long long data = pack(value, depth, bound, generation,
+				   symmetry ? Board::symmetricMove(m, symmetry) : m);
+
+    /* first entry keeps deeper results of current generation,
+     * second entry is always replaced */
+    Entry* e = _entry + (key & _mask) * bucketSize;
+    unsigned long long old = e[0].data.load(std::memory_order_relaxed);
+    unsigned long long oldKey = e[0].check.load(std::memory_order_relaxed) ^ old;
+    if ((old != 0) && (oldKey != key) &&
+	(dataGeneration(old) == generation) && (dataDepth(old) > depth))
+	e++;
+
+    e->check.store(key ^ data, std::memory_order_relaxed);
+    e->data.store(data, std::memory_order_relaxed);
+}
+
+int TranspositionTable::usage()
+{
+    if (!_entry) return 0;
+
+    int used = 0, samples = 0;
+    for(unsigned long long i=0; i<=_mask && samples<1000; i++)
+	for(int j=0; j<bucketSize; j++, samples++) {
+	    unsigned long long data = _entry[i*bucketSize+j].data.load(std::memory_order_relaxed);
+	    if ((data != 0) &&
+		(dataGeneration(data) == (int) (_header->generation & generationMask)))
+		used++;
+	}
+    return samples ? used * 1000 / samples : 0;
+}
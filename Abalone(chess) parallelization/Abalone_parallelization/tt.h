@@ -0,0 +1,114 @@
+/**
+ * TranspositionTable: cache of search results, shared by threads
+ *
+ * Entries are keyed by the Zobrist key of a position (see Board::hashKey)
+ * and store value, bound type and remaining search depth from the view
+ * of the side to move, and the best move found. The table is kept
+ * between searches: instead of clearing it, every search starts a new
+ * generation, and entries of older generations are replaced first.
+ * If the evaluation changes, stored values get invalid, but stored
+ * moves still are good hints for move ordering.
+ *
+ * Optionally, positions are keyed by Board::canonicalKey, so that all
+ * symmetric images of a position (and the one with colors swapped)
+ * share one entry. Moves are stored mapped to the canonical image.
+ *
+ * The table can be backed by a file mapped into memory: it is written
+ * through to the file while searching, and a restarted player using
+ * the same file starts with the table of the previous run.
+ */
+
+#ifndef TT_H
+#define TT_H
+
+#include <atomic>
+
+#include "move.h"
+
+class Board;
+
+class TranspositionTable
+{
+ public:
+    /* bound type of a stored value */
+    enum { none = 0, exact, lower, upper };
+
+    TranspositionTable();
+    ~TranspositionTable() { close(); }
+
+    /**
+     * Allocate table with <mbytes> MB. If <file> is given, the table
+     * is mapped from that file, reusing its content if it was written
+     * by a table of same size and keying. Returns false on error.
+     */
+    bool create(int mbytes, const char* file = 0, bool symmetric = false);
+    void close();
+    bool isValid() { return _entry != 0; }
+
+    /* start a new search: entries found before get older. Generations
+     * are counted in 16 bits; when they wrap, the table is cleared */
+    void newSearch();
+    /* values stored up to now are invalid (evaluation changed) */
+    void invalidateValues();
+    /* remove all entries */
+    void clear();
+    /* write changes to file, if file backed */
+    void sync();
+
+    /* key of position in <b>, and the symmetry used for it (see
+     * Board::canonicalKey), to pass into probe() and store() */
+    unsigned long long key(Board* b, int& symmetry);
+    /* same, with Board::hashKey() of <b> already known as <hash> */
+    unsigned long long key(Board* b, unsigned long long hash, int& symmetry);
+
+    /**
+     * Look up position <key> searched with remaining depth <depth>.
+     * Sets <m> to the stored best move (or type none). Returns true if
+     * the stored value is usable within window [alpha;beta], and sets
+     * <value> then.
+     */
+    bool probe(unsigned long long key, int symmetry, int depth,
+	       int alpha, int beta, int& value, Move& m);
+
+    /* store search result for position <key> */
+    void store(unsigned long long key, int symmetry, int depth,
+	       int value, int bound, const Move& m);
+
+    int mbytes() { return _mbytes; }
+    bool isFileBacked() { return _file; }
+    bool isSymmetric() { return _symmetric; }
+    /* permille of sampled entries filled in current generation */
+    int usage();
+
+ private:
+    /* key is stored XORed with data, so that a torn entry written
+     * concurrently by two threads does not validate on lookup */
+    struct Entry {
+	std::atomic<unsigned long long> check; // key ^ data
+	std::atomic<unsigned long long> data;
+    };
+    /* two entries per bucket: depth preferred and always replaced */
+    enum { bucketSize = 2 };
+    /* header flags */
+    enum { symmetricKeys = 1 };
+
+    struct Header {
+	char magic[8];
+	unsigned long long buckets;
+	std::atomic<unsigned int> generation; // searches may start concurrently;
+	                                      // entries keep its low 16 bits
+	unsigned int valueGeneration; // first generation with valid values
+	unsigned int flags;
+    };
+
+    Header* _header;
+    Entry* _entry;
+    unsigned long long _mask;
+    void* _map;
+    long _mapSize;
+    int _mbytes;
+    bool _file;
+    bool _symmetric;
+};
+
+#endif
@@ -0,0 +1,402 @@
+/**
+ * Tune coefficients of the evaluation scheme
+ *
+ * Labelled positions come from game logs (positions in the format of
+ * Board::getState, as printed by "referee"), and/or from self-play
+ * games played in parallel. Each position is labelled with the result
+ * of its game for the side which moved last.
+ *
+ * The value of a position is linear in the coefficients (see
+ * Evaluator::features), so each position is reduced to its feature
+ * counts once. The coefficients are then fitted by logistic regression
+ * ("Texel tuning"): minimize the mean squared difference between game
+ * result and sigmoid(K * value). The gradient over all positions is
+ * computed by OpenMP threads with array reductions.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <sys/time.h>
+#include <omp.h>
+
+#include "board.h"
+#include "search.h"
+#include "eval.h"
+
+enum { P = EvalScheme::paramCount };
+
+static EvalScheme scheme(0);
+static Evaluator ev;
+
+static const char* schemeFile = 0;
+static const char* outFile = "abalone.eval";
+static const char* logFile = 0;
+static int games = 0;
+static int strategyNo = 0;
+static int strength = 2;
+static int randomPlies = 6;
+static int maxPlies = 300;
+static int iterations = 500;
+static double rate = 2.0;
+
+static const char* files[20];
+static int fileCount = 0;
+
+
+/// Labelled positions
+
+/* feature counts (P per position) and result for side which moved last */
+struct Samples {
+    int count, size;
+    short* x;
+    float* result;
+};
+
+static void addSample(Samples& s, const int* x, float result)
+{
+    if (s.count == s.size) {
+	s.size = s.size ? 2*s.size : 4096;
+	s.x = (short*) realloc(s.x, sizeof(short) * P * s.size);
+	s.result = (float*) realloc(s.result, sizeof(float) * s.size);
+    }
+    for(int i=0; i<P; i++)
+	s.x[s.count*P + i] = x[i];
+    s.result[s.count++] = result;
+}
+
+/* add positions of one game, labelled with result of final position */
+static void addGame(Samples& s, Board* positions, int count)
+{
+    if (count == 0) return;
+
+    int state = positions[count-1].validState();
+    int winner = (state == Board::win1 || state == Board::timeout2) ? Board::color1 :
+	(state == Board::win2 || state == Board::timeout1) ? Board::color2 : 0;
+
+    int x[P];
+    for(int i=0; i<count; i++) {
+	Board& b = positions[i];
+	if (!ev.features(&b, x)) continue;
+	// values are from view of color not to move
+	float r = (winner == 0) ? 0.5 : (winner == b.actColor()) ? 0.0 : 1.0;
+	addSample(s, x, r);
+    }
+}
+
+/* Read games from a log: a game ends when move numbers do not
+ * increase any more. Returns number of games */
+static int readLog(const char* file, Samples& s)
+{
+    FILE* f = (strcmp(file, "-") == 0) ? stdin : fopen(file, "r");
+    if (!f) {
+	printf("WARNING - Can not open '%s' for reading games\n", file);
+	return 0;
+    }
+
+    char line[256], state[1024];
+    int len = 0, borders = 0, gameCount = 0;
+    int count = 0, size = 256;
+    Board* positions = new Board[size];
+
+    while(fgets(line, sizeof(line), f)) {
+	bool border = (strstr(line, "-----------") != 0);
+
+	// header line "#<moveNo> ..." in front of a board
+	if (borders == 0) {
+	    if (line[0] == '#') {
+		len = snprintf(state, sizeof(state), "%s", line);
+		continue;
+	    }
+	    if (!border) continue;
+	}
+	if (len + (int)strlen(line) < (int)sizeof(state))
+	    len += sprintf(state+len, "%s", line);
+	if (border) borders++;
+	if (borders < 2) continue;
+	len = borders = 0;
+
+	Board b;
+	if (!b.setState(state) || (b.moveNo() < 0)) continue;
+	if ((count > 0) && (b.moveNo() <= positions[count-1].moveNo())) {
+	    addGame(s, positions, count);
+	    gameCount++;
+	    count = 0;
+	}
+	if (count == size) {
+	    Board* p = new Board[2*size];
+	    for(int i=0; i<count; i++) p[i] = positions[i];
+	    delete[] positions;
+	    positions = p;
+	    size *= 2;
+	}
+	positions[count++] = b;
+    }
+    if (count > 0) {
+	addGame(s, positions, count);
+	gameCount++;
+    }
+
+    delete[] positions;
+    if (f != stdin) fclose(f);
+    return gameCount;
+}
+
+/* Play games in parallel: random opening moves, then searches with
+ * the given strategy for both sides. Returns number of games */
+static int selfPlay(Samples& s, FILE* log)
+{
+    SearchStrategy* proto = SearchStrategy::create(strategyNo);
+    if (!proto) return 0;
+    printf("Playing %d games with strategy '%s' (strength %d), %d random plies ...\n",
+	   games, proto->name(), strength, randomPlies);
+
+    #pragma omp parallel
+    {
+	SearchStrategy* ss = proto->clone();
+	SearchCallbacks sc(0);
+	ss->setMaxDepth(strength);
+	ss->setEvaluator(&ev);
+	// searches inside of games run sequentially
+	ss->setThreads(1);
+	ss->registerCallbacks(&sc);
+	Board* positions = new Board[maxPlies+1];
+	Samples own = { 0, 0, 0, 0 };
+
+	#pragma omp for schedule(dynamic,1)
+	for(int g=0; g<games; g++) {
+	    unsigned int seed = g + 1;
+	    Board b;
+	    b.begin(Board::color1);
+	    b.setMoveNo(0);
+
+	    int count = 0;
+	    for(int ply=0; ply<maxPlies; ply++) {
+		int state = b.validState();
+		if ((state != Board::valid1) && (state != Board::valid2)) break;
+
+		Move m;
+		if (ply < randomPlies) {
+		    MoveList list;
+		    b.generateMoves(list);
+		    int n = rand_r(&seed) % list.getLength();
+		    for(int i=0; i<=n; i++) list.getNext(m);
+		}
+		else {
+		    m = ss->bestMove(&b);
+		    positions[count++] = b;
+		}
+		if (m.type == Move::none) break;
+		b.playMove(m);
+	    }
+	    positions[count++] = b;
+
+	    if (log) {
+		#pragma omp critical (tuneLog)
+		for(int i=0; i<count; i++)
+		    fprintf(log, "%s\n", positions[i].getState());
+	    }
+	    addGame(own, positions, count);
+	}
+
+	#pragma omp critical (tuneSamples)
+	for(int i=0; i<own.count; i++) {
+	    int x[P];
+	    for(int j=0; j<P; j++) x[j] = own.x[i*P + j];
+	    addSample(s, x, own.result[i]);
+	}
+	free(own.x);
+	free(own.result);
+	delete[] positions;
+	delete ss;
+    }
+    return games;
+}
+
+
+/// Logistic regression
+
+static inline double sigmoid(double v) { return 1.0 / (1.0 + exp(-v)); }
+
+/* mean squared error of prediction sigmoid(K * value), with gradient
+ * for coefficients <w> if <grad> is given */
+static double error(const Samples& s, const double* w, double K, double* grad)
+{
+    double sum = 0, g[P];
+    for(int j=0; j<P; j++) g[j] = 0;
+
+    #pragma omp parallel for schedule(static) reduction(+: sum, g[:P])
+    for(int i=0; i<s.count; i++) {
+	const short* x = s.x + i*P;
+	double v = 0;
+	for(int j=0; j<P; j++) v += w[j] * x[j];
+	double p = sigmoid(K * v);
+	double d = s.result[i] - p;
+	sum += d*d;
+	if (grad) {
+	    double f = -2.0 * d * p * (1.0 - p) * K;
+	    for(int j=0; j<P; j++) g[j] += f * x[j];
+	}
+    }
+
+    if (grad)
+	for(int j=0; j<P; j++) grad[j] = g[j] / s.count;
+    return sum / s.count;
+}
+
+/* scaling constant K of the sigmoid fitting current coefficients best,
+ * by golden section search on log(K) */
+static double fitScaling(const Samples& s, const double* w)
+{
+    double lo = log(1e-5), hi = log(1e-1);
+    const double r = 0.618034;
+    for(int i=0; i<40; i++) {
+	double a = hi - r * (hi - lo), b = lo + r * (hi - lo);
+	if (error(s, w, exp(a), 0) < error(s, w, exp(b), 0))
+	    hi = b;
+	else
+	    lo = a;
+    }
+    return exp((lo + hi) / 2);
+}
+
+static double msecsSince(struct timeval& t1)
+{
+    struct timeval t2;
+    gettimeofday(&t2,0);
+    return (1000.0 * t2.tv_sec + t2.tv_usec / 1000.0) -
+	(1000.0 * t1.tv_sec + t1.tv_usec / 1000.0);
+}
+
+/* gradient descent with per-coefficient step sizes (Adam) */
+static void tune(const Samples& s)
+{
+    double w[P], m[P], v[P], grad[P];
+    for(int j=0; j<P; j++) {
+	w[j] = scheme.param(j);
+	m[j] = v[j] = 0;
+    }
+
+    struct timeval t1;
+    gettimeofday(&t1,0);
+    double K = fitScaling(s, w);
+    double e = error(s, w, K, grad);
+    printf("Scaling K = %g, error %.6f (%.0f ms)\n", K, e, msecsSince(t1));
+
+    const double beta1 = 0.9, beta2 = 0.999;
+    gettimeofday(&t1,0);
+    for(int it=1; it<=iterations; it++) {
+	for(int j=0; j<P; j++) {
+	    m[j] = beta1 * m[j] + (1-beta1) * grad[j];
+	    v[j] = beta2 * v[j] + (1-beta2) * grad[j] * grad[j];
+	    double mh = m[j] / (1 - pow(beta1, it));
+	    double vh = v[j] / (1 - pow(beta2, it));
+	    w[j] -= rate * mh / (sqrt(vh) + 1e-12);
+	}
+	e = error(s, w, K, grad);
+	if ((it % 50 == 0) || (it == iterations))
+	    printf(" Iteration %4d: error %.6f (%.1f ms per gradient)\n",
+		   it, e, msecsSince(t1) / it);
+    }
+
+    for(int j=0; j<P; j++)
+	scheme.setParam(j, (int) lround(w[j]));
+}
+
+
+static void printHelp(char* prg)
+{
+    printf("Tune V 0.1\n"
+	   "Fit evaluation coefficients to results of games.\n\n");
+    printf("Usage: %s [options] [<file> ...]\n\n"
+	   "  <file>           Game log with positions (\"-\": stdin)\n\n", prg);
+    printf(" Options:\n"
+	   "  -h / --help      Print this help text\n"
+	   "  -e <file>        Start with coefficients from file (default: built-in)\n"
+	   "  -o <file>        File to write tuned coefficients (default: %s)\n"
+	   "  -g <games>       Generate positions by self-play games\n"
+	   "  -w <file>        Write positions of self-play games to file\n"
+	   "  -s <strategy>    Number of strategy for self-play (default: %d)\n"
+	   "  -d <strength>    Strength for self-play (default: %d)\n"
+	   "  -r <plies>       Random plies at start of self-play games (default: %d)\n"
+	   "  -i <count>       Iterations of gradient descent (default: %d)\n"
+	   "  -l <rate>        Step size of gradient descent (default: %g)\n\n",
+	   outFile, strategyNo, strength, randomPlies, iterations, rate);
+
+    printf(" Available search strategies for option '-s':\n");
+    const char** strs = SearchStrategy::strategies();
+    for(int i = 0; strs[i]; i++)
+	printf("  %2d : Strategy '%s'\n", i, strs[i]);
+    printf("\n");
+    exit(1);
+}
+
+static void parseArgs(int argc, char* argv[])
+{
+    int arg=0;
+    while(arg+1<argc) {
+	arg++;
+	if (strcmp(argv[arg],"-h")==0 ||
+	    strcmp(argv[arg],"--help")==0) printHelp(argv[0]);
+	if ((argv[arg][0] != '-') || (strcmp(argv[arg],"-")==0)) {
+	    if (fileCount < 20) files[fileCount++] = argv[arg];
+	    continue;
+	}
+	if (arg+1 >= argc) {
+	    printf("ERROR - Unknown option %s\n", argv[arg]);
+	    printHelp(argv[0]);
+	}
+	if (strcmp(argv[arg],"-e")==0) schemeFile = argv[++arg];
+	else if (strcmp(argv[arg],"-o")==0) outFile = argv[++arg];
+	else if (strcmp(argv[arg],"-g")==0) games = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-w")==0) logFile = argv[++arg];
+	else if (strcmp(argv[arg],"-s")==0) strategyNo = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-d")==0) strength = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-r")==0) randomPlies = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-i")==0) iterations = atoi(argv[++arg]);
+	else if (strcmp(argv[arg],"-l")==0) rate = atof(argv[++arg]);
+	else {
+	    printf("ERROR - Unknown option %s\n", argv[arg]);
+	    printHelp(argv[0]);
+	}
+    }
+    if ((fileCount == 0) && (games <= 0)) printHelp(argv[0]);
+}
+
+int main(int argc, char* argv[])
+{
+    parseArgs(argc, argv);
+
+    if (schemeFile && !scheme.read(schemeFile))
+	printf("WARNING - Can not read coefficients from '%s'\n", schemeFile);
+    ev.setEvalScheme(&scheme);
+
+    Samples s = { 0, 0, 0, 0 };
+    struct timeval t1;
+    gettimeofday(&t1,0);
+
+    for(int i=0; i<fileCount; i++) {
+	int n = readLog(files[i], s);
+	printf("Read %d games from '%s'\n", n, files[i]);
+    }
+    if (games > 0) {
+	FILE* log = logFile ? fopen(logFile, "w") : 0;
+	if (logFile && !log)
+	    printf("WARNING - Can not open '%s' for writing positions\n", logFile);
+	selfPlay(s, log);
+	if (log) fclose(log);
+    }
+    printf("%d positions (%.0f ms), %d threads\n",
+	   s.count, msecsSince(t1), omp_get_max_threads());
+    if (s.count == 0) return 1;
+
+    tune(s);
+
+    if (!scheme.save(outFile)) {
+	printf("ERROR - Can not write '%s'\n", outFile);
+	return 1;
+    }
+    printf("Wrote coefficients to '%s'\n", outFile);
+    return 0;
+}